@@ -0,0 +1,13 @@
+# Turns a tree-sitter query file into a C source defining the query text as
+# a null-terminated array NAME and its length NAME_len.
+#
+# Usage: cmake -DNAME=<symbol> -DINPUT=<query.scm> -DOUTPUT=<file.c> -P embed_query.cmake
+
+file(READ ${INPUT} content HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," content "${content}")
+
+file(WRITE ${OUTPUT}
+     "// generated from ${INPUT}, do not edit\n"
+     "#include <stddef.h>\n\n"
+     "const char ${NAME}[] = {${content}0x00};\n"
+     "const size_t ${NAME}_len = sizeof(${NAME}) - 1;\n")
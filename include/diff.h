@@ -0,0 +1,28 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// old_count lines of the old version starting at old_start were replaced by
+// new_count lines of the new version starting at new_start
+struct DiffHunk {
+    uint32_t old_start;
+    uint32_t old_count;
+    uint32_t new_start;
+    uint32_t new_count;
+};
+
+struct Diff {
+    struct DiffHunk *hunks; // sorted, never adjacent to each other
+    size_t count;
+    size_t cap;
+};
+
+uint64_t diff_hash_line(const char *line, size_t len);
+int diff_lines(struct Diff *diff, const uint64_t *old, size_t old_count,
+               const uint64_t *new, size_t new_count);
+void diff_free(struct Diff *diff);
+const struct DiffHunk *diff_find(const struct Diff *diff, size_t row);
+
+#endif // !DIFF_H
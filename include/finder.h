@@ -0,0 +1,45 @@
+#ifndef FINDER_H
+#define FINDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// every file below a directory. the paths are NUL-terminated and live back to
+// back in one arena, paths[] holds their offsets
+struct FileList {
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    uint32_t *paths;
+    uint64_t *masks; // which characters occur in each path, see char_mask()
+    size_t count;
+    size_t cap;
+};
+
+struct FinderMatch {
+    uint32_t file;
+    int32_t score;
+};
+
+struct Finder {
+    const struct FileList *files;
+    char query[256];
+    size_t query_len;
+    uint32_t *matches; // every file matching query, unsorted
+    size_t match_count;
+    struct FinderMatch *top; // the best matches, best first
+    size_t top_count;
+    size_t top_cap;
+};
+
+int file_list_walk(struct FileList *list, const char *root);
+void file_list_free(struct FileList *list);
+const char *file_list_path(const struct FileList *list, uint32_t file);
+
+int finder_init(struct Finder *finder, const struct FileList *files,
+                size_t top);
+void finder_free(struct Finder *finder);
+int finder_set_top(struct Finder *finder, size_t top);
+int finder_set_query(struct Finder *finder, const char *query, size_t len);
+
+#endif // !FINDER_H
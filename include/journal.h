@@ -0,0 +1,101 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define JOURNAL_MAGIC "LEJOURNL"
+#define JOURNAL_VERSION 1
+
+// the journal file is a header followed by records. it ends at the first
+// record whose checksum does not match, that is the write a crash cut off
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t base_size; // the file on disk the records apply to
+    int64_t base_mtime_sec;
+    int64_t base_mtime_nsec;
+};
+
+enum journalRecordType {
+    JOURNAL_EDITS = 1, // bytes [start, end) of the text are replaced
+    JOURNAL_ROWS,      // rows [start, end) of the file on disk are replaced
+};
+
+// followed by count JournalEdits and then the text they insert
+struct JournalRecord {
+    uint32_t type;
+    uint32_t count;
+    uint64_t size;     // of everything after this struct
+    uint64_t checksum; // of the whole record, taken with checksum set to 0
+};
+
+// all edits of a record apply to the text as it was before the record
+struct JournalEdit {
+    uint64_t start;
+    uint64_t end;
+    uint64_t text; // offset of the inserted text
+    uint64_t len;
+};
+
+// a journal mapped for replay
+struct JournalReader {
+    void *map;
+    size_t map_size;
+    const struct JournalHeader *header;
+    size_t end;    // of the last intact record
+    size_t offset; // of the next record journal_read_next() returns
+    size_t records;
+};
+
+// records are queued by the UI thread and written by a thread of their own,
+// which writes everything that queued up during its last fdatasync at once
+struct Journal {
+    bool started;
+    char path[4096];
+    struct JournalHeader header;
+    int fd; // the file is only created by the first write
+    size_t keep; // bytes of an existing journal that are continued
+    pthread_t thread;
+    pthread_mutex_t lock; // guards everything below
+    pthread_cond_t wake;
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    char *compacted; // replaces the file before pending is written
+    size_t compacted_len;
+    bool stop;
+    int error; // of the last failed write, no records are written after it
+    size_t records; // in the file once everything queued is written
+    size_t size;    // bytes queued since the last compaction
+};
+
+int journal_path(const char *filename, char *path, size_t size);
+struct JournalHeader journal_header(int64_t base_size,
+                                    struct timespec base_mtime);
+bool journal_header_matches(const struct JournalHeader *a,
+                            const struct JournalHeader *b);
+
+int journal_read_open(struct JournalReader *reader, const char *path);
+bool journal_read_next(struct JournalReader *reader,
+                       const struct JournalRecord **record,
+                       const struct JournalEdit **edits, const char **text);
+void journal_read_close(struct JournalReader *reader);
+
+int journal_start(struct Journal *journal, const char *path,
+                  const struct JournalHeader *header,
+                  const struct JournalReader *keep);
+int journal_append(struct Journal *journal, uint32_t type,
+                   const struct JournalEdit *edits, size_t count,
+                   const char *text);
+int journal_compact(struct Journal *journal,
+                    const struct JournalHeader *header, uint32_t type,
+                    const struct JournalEdit *edits, size_t count,
+                    const char *text);
+void journal_close(struct Journal *journal, bool remove);
+
+#endif // !JOURNAL_H
@@ -0,0 +1,62 @@
+#ifndef LANGUAGE_H
+#define LANGUAGE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "tree_sitter/api.h"
+
+typedef enum {
+    HL_NORMAL = 0,
+    HL_FUNCTION,
+    HL_FUNCTION_BUILTIN,
+    HL_TYPE,
+    HL_TYPE_BUILTIN,
+    HL_KEYWORD,
+    HL_KEYWORD_CONTROL,
+    HL_VARIABLE,
+    HL_VARIABLE_PARAMETER,
+    HL_CONSTANT,
+    HL_CONSTANT_BUILTIN,
+    HL_STRING,
+    HL_COMMENT,
+    HL_NUMBER,
+    HL_OPERATOR,
+    HL_PUNCTUATION,
+    HL_LABEL,
+} HighlightType;
+
+// one entry of the language registry. the grammar and the compiled queries
+// are loaded on first use and shared by every buffer in that language
+struct Language {
+    const char *name;
+    const char *const *extensions; // NULL-terminated, without the dot
+    const char *const *shebangs;   // interpreter names, NULL-terminated
+    const TSLanguage *(*grammar)(void); // statically linked, NULL to dlopen
+    const char *highlights;             // bundled queries, may be NULL
+    const size_t *highlights_len;
+    const char *tags;
+    const size_t *tags_len;
+
+    pthread_mutex_t grammar_lock;
+    int grammar_loaded;
+    void *handle;
+    const TSLanguage *ts_language;
+
+    pthread_mutex_t query_lock;
+    int query_loaded;
+    TSQuery *highlight_query;
+    HighlightType *capture_types; // indexed by capture id
+
+    pthread_mutex_t tags_lock;
+    int tags_loaded;
+    TSQuery *tags_query;
+};
+
+struct Language *language_detect(const char *path, const char *text,
+                                 size_t len);
+const TSLanguage *language_grammar(struct Language *lang);
+TSQuery *language_highlight_query(struct Language *lang);
+TSQuery *language_tags_query(struct Language *lang);
+char *language_read_user_query(const char *lang, const char *name, long *len);
+
+#endif // !LANGUAGE_H
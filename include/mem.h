@@ -0,0 +1,41 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// what memory is counted towards. file mappings are counted where they
+// stand in for heap memory, like the mapped text of a buffer
+enum memSubsystem {
+    MEM_TEXT = 0,  // buffer text, mapped or on the heap
+    MEM_ROWS,      // erow arrays and their column checkpoints
+    MEM_INDEX,     // row hashes, the wrap layout, the finder and symbol index
+    MEM_TREE,      // everything tree-sitter allocates
+    MEM_HIGHLIGHT, // highlight snapshots
+    MEM_UNDO,      // edit transactions and the undo and redo stacks
+    MEM_DIFF,      // hunks, the hashes a diff runs on and its work arrays
+    MEM_JOURNAL,   // records waiting for the writer, mapped journals
+    MEM_CELLS,     // the cell buffer, row windows, the frame and unsent output
+    MEM_TOTAL,     // only for limits and reports
+};
+
+void *mem_malloc(enum memSubsystem subsystem, size_t size);
+void *mem_calloc(enum memSubsystem subsystem, size_t count, size_t size);
+void *mem_realloc(enum memSubsystem subsystem, void *ptr, size_t size);
+void mem_free(void *ptr);
+void mem_account(enum memSubsystem subsystem, int64_t bytes);
+void mem_use_for_tree_sitter(void);
+
+size_t mem_used(enum memSubsystem subsystem);
+const char *mem_name(enum memSubsystem subsystem);
+size_t mem_limit(enum memSubsystem subsystem);
+bool mem_over_limit(enum memSubsystem subsystem);
+int mem_load_limits(void);
+
+int mem_summary(char *buf, size_t size);
+int mem_dump_path(char *path, size_t size);
+int mem_dump(FILE *file);
+
+#endif // !MEM_H
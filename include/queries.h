@@ -0,0 +1,12 @@
+#ifndef QUERIES_H
+#define QUERIES_H
+
+#include <stddef.h>
+
+// query sources embedded at build time, see embed_query() in CMakeLists.txt
+extern const char query_c_highlights[];
+extern const size_t query_c_highlights_len;
+extern const char query_c_tags[];
+extern const size_t query_c_tags_len;
+
+#endif // !QUERIES_H
@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SNAPSHOT_MAGIC "LEHLSNAP"
+#define SNAPSHOT_VERSION 1
+
+// the highlighting of the start of a file, saved when it is closed so the
+// next open can paint it before the parse is done. the file is the header
+// followed by the spans in the order they were painted
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t span_count;
+    int64_t size; // of the file the spans were taken from
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t covered; // the spans lie in the file's first covered bytes
+    uint64_t hash;    // of those bytes
+};
+
+struct SnapshotSpan {
+    uint32_t start;
+    uint32_t end;
+    uint32_t type; // a HighlightType
+};
+
+struct Snapshot {
+    void *map;
+    size_t map_size;
+    const struct SnapshotHeader *header;
+    const struct SnapshotSpan *spans;
+};
+
+int snapshot_cache_path(const char *filename, char *path, size_t size);
+int snapshot_open(struct Snapshot *snapshot, const char *path, int64_t size,
+                  struct timespec mtime, const char *text, size_t len);
+int snapshot_write(const char *path, const struct SnapshotHeader *header,
+                   const struct SnapshotSpan *spans);
+void snapshot_close(struct Snapshot *snapshot);
+
+#endif // !SNAPSHOT_H
@@ -0,0 +1,69 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_INDEX_MAGIC "LESYMIDX"
+#define SYMBOL_INDEX_VERSION 1
+
+enum symbolKind {
+    SYM_FUNCTION = 1,
+    SYM_TYPE,
+    SYM_MACRO,
+};
+
+// the index file is these structs laid out back to back, so it can be
+// mapped and searched without parsing:
+//   header, files (sorted by path), symbols (grouped by file),
+//   by_name (symbol ids sorted by name), string pool
+struct SymbolIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t symbol_count;
+    uint32_t strings_size;
+};
+
+struct SymbolFile {
+    uint32_t path; // offsets into the string pool
+    uint32_t first_symbol;
+    uint32_t symbol_count;
+    uint32_t reserved;
+    int64_t mtime;
+    int64_t size;
+    uint64_t hash;
+};
+
+struct Symbol {
+    uint32_t name;
+    uint32_t file;
+    uint32_t row;
+    uint32_t column;
+    uint32_t kind;
+};
+
+struct SymbolIndex {
+    void *map;
+    size_t map_size;
+    const struct SymbolIndexHeader *header;
+    const struct SymbolFile *files;
+    const struct Symbol *symbols;
+    const uint32_t *by_name;
+    const char *strings;
+};
+
+int symbol_index_cache_path(const char *root, char *path, size_t size);
+int symbol_index_open(struct SymbolIndex *index, const char *path);
+int symbol_index_update(const struct SymbolIndex *old, const char *root,
+                        const char *path);
+void symbol_index_close(struct SymbolIndex *index);
+size_t symbol_index_count(const struct SymbolIndex *index);
+const struct Symbol *symbol_index_at(const struct SymbolIndex *index,
+                                     size_t i);
+size_t symbol_index_find(const struct SymbolIndex *index, const char *name,
+                         size_t len, size_t *first);
+const char *symbol_index_string(const struct SymbolIndex *index,
+                                uint32_t offset);
+
+#endif // !SYMBOLS_H
@@ -1,6 +1,7 @@
 #ifndef TERMINAL_H
 #define TERMINAL_H
 
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
@@ -31,6 +32,8 @@ enum editorKey {
     KEY_ENTER,
     KEY_TAB,
     KEY_ESC,
+    KEY_WAKE,   // terminal_wake() was called, no key was pressed
+    KEY_RESIZE, // the window changed size and the cell buffer was cleared
 };
 
 typedef struct {
@@ -53,17 +56,35 @@ struct CellBuffer {
 struct Global {
     struct termios orig_termios;
     struct CellBuffer front;
+    int orig_flags;   // stdout file status flags before O_NONBLOCK
+    char *frame;      // scratch buffer a frame is rendered into
+    size_t frame_cap;
+    size_t frame_len; // size of the last rendered frame
+    char *out;        // bytes the terminal has not accepted yet
+    size_t out_len;
+    size_t out_cap;
+    int frame_pending; // a refresh was skipped while output was in flight
+    int sync_output;   // terminal supports synchronized output (mode 2026)
+    int cursor_x;
+    int cursor_y;
+    int cursor_visible;
+    int wake_pipe[2];
+    volatile sig_atomic_t resized; // set by the SIGWINCH handler
 };
 
 int terminal_end();
 int terminal_init();
 int terminal_get_cursor_pos(int *x, int *y);
 int terminal_move_cursor(int x, int y);
+void terminal_show_cursor(int visible);
 int terminal_get_size(int *cols, int *rows);
 int cell_buffer_init(struct CellBuffer *buffer, int width, int height);
 void cell_buffer_free(struct CellBuffer *buffer);
 int terminal_refresh();
+int terminal_flush();
+size_t terminal_pending_bytes();
 int terminal_cell_set(int x, int y, struct Cell cell);
 int terminal_read_input();
+void terminal_wake();
 
 #endif // !TERMINAL_H
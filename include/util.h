@@ -0,0 +1,13 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTIL_HASH_SEED 0xcbf29ce484222325ULL
+
+uint64_t util_hash(uint64_t hash, const void *data, size_t len);
+int util_make_dirs(char *path);
+int util_write_all(int fd, const void *data, size_t len);
+
+#endif // !UTIL_H
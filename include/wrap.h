@@ -0,0 +1,32 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// how many display lines each buffer row takes when wrapped at cols. the
+// counts are kept in a Fenwick tree, so display lines and rows map to each
+// other in O(log n) and a changed row is updated in O(log n)
+struct WrapLayout {
+    int cols;
+    size_t count;
+    uint32_t *widths; // display width of every row
+    uint32_t *tree;   // 1-based Fenwick tree over the line counts
+    size_t top;       // highest power of two <= count
+};
+
+int wrap_layout_init(struct WrapLayout *layout, size_t count, int cols);
+void wrap_layout_free(struct WrapLayout *layout);
+void wrap_layout_rebuild(struct WrapLayout *layout);
+int wrap_layout_set_rows(struct WrapLayout *layout, uint32_t *widths,
+                         size_t count);
+void wrap_layout_set_width(struct WrapLayout *layout, size_t row,
+                           uint32_t width);
+void wrap_layout_set_cols(struct WrapLayout *layout, int cols);
+size_t wrap_layout_lines(const struct WrapLayout *layout, size_t row);
+size_t wrap_layout_line_of(const struct WrapLayout *layout, size_t row);
+size_t wrap_layout_total(const struct WrapLayout *layout);
+size_t wrap_layout_row_at(const struct WrapLayout *layout, size_t line,
+                          size_t *sub);
+
+#endif // !WRAP_H
@@ -0,0 +1,232 @@
+#include "diff.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "mem.h"
+#include "util.h"
+
+// past this many edits in one region the search gives up and reports the
+// whole region as replaced, which bounds the work at O(N * MAX_COST)
+#define MAX_COST 4096
+
+struct diffContext {
+    const uint64_t *a;
+    const uint64_t *b;
+    int64_t *vf; // furthest reaching paths forwards and backwards
+    int64_t *vb;
+    struct Diff *diff;
+};
+
+uint64_t diff_hash_line(const char *line, size_t len) {
+    return util_hash(UTIL_HASH_SEED, line, len);
+}
+
+static int add_hunk(struct Diff *diff, size_t old_start, size_t old_count,
+                    size_t new_start, size_t new_count) {
+    if (old_count == 0 && new_count == 0)
+        return 0;
+
+    // the recursion emits edits in order, so neighbours are merged here
+    if (diff->count > 0) {
+        struct DiffHunk *last = &diff->hunks[diff->count - 1];
+        if (last->old_start + last->old_count == old_start &&
+            last->new_start + last->new_count == new_start) {
+            last->old_count += old_count;
+            last->new_count += new_count;
+            return 0;
+        }
+    }
+
+    if (diff->count == diff->cap) {
+        size_t cap = diff->cap ? diff->cap * 2 : 64;
+        struct DiffHunk *hunks = mem_realloc(MEM_DIFF, diff->hunks,
+                                                 sizeof(*hunks) * cap);
+        if (!hunks) {
+            errno = ENOMEM;
+            return -1;
+        }
+        diff->hunks = hunks;
+        diff->cap = cap;
+    }
+
+    diff->hunks[diff->count++] = (struct DiffHunk){
+            .old_start = old_start,
+            .old_count = old_count,
+            .new_start = new_start,
+            .new_count = new_count,
+    };
+
+    return 0;
+}
+
+// finds a point on the middle snake of an optimal edit script between
+// a[a_lo, a_hi) and b[b_lo, b_hi), searching from both ends at once so
+// only O(N) memory is needed. both ranges are non-empty
+static bool bisect(struct diffContext *ctx, size_t a_lo, size_t a_hi,
+                   size_t b_lo, size_t b_hi, size_t *x_out, size_t *y_out) {
+    const uint64_t *a = ctx->a + a_lo;
+    const uint64_t *b = ctx->b + b_lo;
+    int64_t n = a_hi - a_lo;
+    int64_t m = b_hi - b_lo;
+
+    int64_t max_d = (n + m + 1) / 2;
+    if (max_d > MAX_COST)
+        max_d = MAX_COST;
+    int64_t offset = max_d + 1;
+    int64_t length = 2 * max_d + 3;
+    for (int64_t i = 0; i < length; i++) {
+        ctx->vf[i] = -1;
+        ctx->vb[i] = -1;
+    }
+    ctx->vf[offset + 1] = 0;
+    ctx->vb[offset + 1] = 0;
+
+    int64_t delta = n - m;
+    bool front = (delta & 1) != 0;
+    int64_t k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+
+    for (int64_t d = 0; d < max_d; d++) {
+        for (int64_t k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+            int64_t i1 = offset + k1;
+            int64_t x1 = (k1 == -d || (k1 != d && ctx->vf[i1 - 1] <
+                                                          ctx->vf[i1 + 1]))
+                                 ? ctx->vf[i1 + 1]
+                                 : ctx->vf[i1 - 1] + 1;
+            int64_t y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                x1++;
+                y1++;
+            }
+            ctx->vf[i1] = x1;
+
+            if (x1 > n) {
+                k1_end += 2;
+            } else if (y1 > m) {
+                k1_start += 2;
+            } else if (front) {
+                int64_t i2 = offset + delta - k1;
+                if (i2 >= 0 && i2 < length && ctx->vb[i2] != -1 &&
+                    x1 >= n - ctx->vb[i2]) {
+                    *x_out = a_lo + x1;
+                    *y_out = b_lo + y1;
+                    return true;
+                }
+            }
+        }
+
+        for (int64_t k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+            int64_t i2 = offset + k2;
+            int64_t x2 = (k2 == -d || (k2 != d && ctx->vb[i2 - 1] <
+                                                          ctx->vb[i2 + 1]))
+                                 ? ctx->vb[i2 + 1]
+                                 : ctx->vb[i2 - 1] + 1;
+            int64_t y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                x2++;
+                y2++;
+            }
+            ctx->vb[i2] = x2;
+
+            if (x2 > n) {
+                k2_end += 2;
+            } else if (y2 > m) {
+                k2_start += 2;
+            } else if (!front) {
+                int64_t i1 = offset + delta - k2;
+                if (i1 >= 0 && i1 < length && ctx->vf[i1] != -1) {
+                    int64_t x1 = ctx->vf[i1];
+                    int64_t y1 = offset + x1 - i1;
+                    if (x1 >= n - x2) {
+                        *x_out = a_lo + x1;
+                        *y_out = b_lo + y1;
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static int diff_range(struct diffContext *ctx, size_t a_lo, size_t a_hi,
+                      size_t b_lo, size_t b_hi) {
+    // lines equal at either end are never part of the script, after an
+    // edit this leaves just the region around it
+    while (a_lo < a_hi && b_lo < b_hi && ctx->a[a_lo] == ctx->b[b_lo]) {
+        a_lo++;
+        b_lo++;
+    }
+    while (a_lo < a_hi && b_lo < b_hi &&
+           ctx->a[a_hi - 1] == ctx->b[b_hi - 1]) {
+        a_hi--;
+        b_hi--;
+    }
+
+    if (a_lo == a_hi || b_lo == b_hi)
+        return add_hunk(ctx->diff, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo);
+
+    size_t x, y;
+    if (!bisect(ctx, a_lo, a_hi, b_lo, b_hi, &x, &y) ||
+        (x == a_lo && y == b_lo) || (x == a_hi && y == b_hi))
+        return add_hunk(ctx->diff, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo);
+
+    if (diff_range(ctx, a_lo, x, b_lo, y) == -1)
+        return -1;
+
+    return diff_range(ctx, x, a_hi, y, b_hi);
+}
+
+// replaces diff's hunks with the ones turning old into new
+int diff_lines(struct Diff *diff, const uint64_t *old, size_t old_count,
+               const uint64_t *new, size_t new_count) {
+    diff->count = 0;
+
+    size_t max_d = (old_count + new_count + 1) / 2;
+    if (max_d > MAX_COST)
+        max_d = MAX_COST;
+    struct diffContext ctx = {
+            .a = old,
+            .b = new,
+            .vf = mem_malloc(MEM_DIFF, sizeof(int64_t) * (2 * max_d + 3)),
+            .vb = mem_malloc(MEM_DIFF, sizeof(int64_t) * (2 * max_d + 3)),
+            .diff = diff,
+    };
+    if (!ctx.vf || !ctx.vb) {
+        mem_free(ctx.vf);
+        mem_free(ctx.vb);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = diff_range(&ctx, 0, old_count, 0, new_count);
+
+    mem_free(ctx.vf);
+    mem_free(ctx.vb);
+
+    return result;
+}
+
+void diff_free(struct Diff *diff) {
+    mem_free(diff->hunks);
+    diff->hunks = NULL;
+    diff->count = 0;
+    diff->cap = 0;
+}
+
+// the last hunk starting at or before row of the new version, NULL if there
+// is none
+const struct DiffHunk *diff_find(const struct Diff *diff, size_t row) {
+    size_t lo = 0;
+    size_t hi = diff->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (diff->hunks[mid].new_start <= row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? &diff->hunks[lo - 1] : NULL;
+}
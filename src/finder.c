@@ -0,0 +1,741 @@
+#include "finder.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "mem.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_WALKERS 16
+#define MAX_SCORERS 16
+// fewer candidates than this per thread are not worth a thread
+#define MIN_CHUNK_SIZE 32768
+#define DIRENT_BUF_SIZE (64 * 1024)
+#define PATH_BATCH_SIZE (64 * 1024)
+// the matcher reads 16 bytes at a time and may run past the last path
+#define ARENA_PADDING 16
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct ignoreRule {
+    char *pattern;
+    int negate;
+    int dir_only;
+    int anchored; // contains a slash, so it matches the whole relative path
+};
+
+// the rules of the ignore files in one directory, chained to the rules of
+// the directories above it
+struct ignoreSet {
+    struct ignoreSet *parent;
+    struct ignoreSet *next_alloc;
+    char *base;
+    struct ignoreRule *rules;
+    int count;
+};
+
+struct walkDir {
+    char *rel;
+    struct ignoreSet *ignores;
+    struct walkDir *next;
+};
+
+struct walkState {
+    int root_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct walkDir *queue;
+    int busy;
+    struct ignoreSet *ignore_sets;
+    struct FileList *list;
+    int failed;
+};
+
+// bit set of the characters in a string, case folded. a path can only match
+// a query whose mask is a subset of its own
+static uint64_t char_mask(const char *str, size_t len) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = tolower((unsigned char) str[i]);
+        if (c >= 'a' && c <= 'z')
+            mask |= 1ULL << (c - 'a');
+        else if (c >= '0' && c <= '9')
+            mask |= 1ULL << (26 + c - '0');
+        else
+            mask |= 1ULL << (36 + c % 28);
+    }
+
+    return mask;
+}
+
+static int list_reserve(struct FileList *list, size_t paths, size_t bytes) {
+    if (list->arena_len + bytes + ARENA_PADDING > list->arena_cap) {
+        size_t cap = list->arena_cap ? list->arena_cap : 1 << 20;
+        while (cap < list->arena_len + bytes + ARENA_PADDING)
+            cap *= 2;
+        char *arena = mem_realloc(MEM_INDEX, list->arena, cap);
+        if (!arena)
+            return -1;
+        list->arena = arena;
+        list->arena_cap = cap;
+    }
+
+    if (list->count + paths > list->cap) {
+        size_t cap = list->cap ? list->cap : 4096;
+        while (cap < list->count + paths)
+            cap *= 2;
+        uint32_t *offsets =
+                mem_realloc(MEM_INDEX, list->paths, cap * sizeof(*offsets));
+        if (!offsets)
+            return -1;
+        list->paths = offsets;
+        uint64_t *masks =
+                mem_realloc(MEM_INDEX, list->masks, cap * sizeof(*masks));
+        if (!masks)
+            return -1;
+        list->masks = masks;
+        list->cap = cap;
+    }
+
+    return 0;
+}
+
+// moves a worker's batch of NUL-separated paths into the shared list
+static int list_append_batch(struct FileList *list, const char *batch,
+                             size_t len, size_t paths) {
+    if (list_reserve(list, paths, len) == -1)
+        return -1;
+
+    memcpy(&list->arena[list->arena_len], batch, len);
+    size_t pos = 0;
+    while (pos < len) {
+        size_t path_len = strlen(&batch[pos]);
+        list->paths[list->count] = list->arena_len + pos;
+        list->masks[list->count] = char_mask(&batch[pos], path_len);
+        list->count++;
+        pos += path_len + 1;
+    }
+    list->arena_len += len;
+    memset(&list->arena[list->arena_len], 0, ARENA_PADDING);
+
+    return 0;
+}
+
+static void parse_ignore_file(struct ignoreSet *set, char *text) {
+    char *save;
+    for (char *line = strtok_r(text, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' '))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        struct ignoreRule rule = {0};
+        if (line[0] == '!') {
+            rule.negate = 1;
+            line++;
+            len--;
+        }
+        if (len > 0 && line[len - 1] == '/') {
+            rule.dir_only = 1;
+            line[--len] = '\0';
+        }
+        if (line[0] == '/') {
+            rule.anchored = 1;
+            line++;
+            len--;
+        }
+        if (len == 0)
+            continue;
+        rule.anchored |= strchr(line, '/') != NULL;
+
+        struct ignoreRule *rules =
+                realloc(set->rules, (set->count + 1) * sizeof(*rules));
+        if (!rules)
+            return;
+        set->rules = rules;
+        rule.pattern = strdup(line);
+        if (rule.pattern)
+            set->rules[set->count++] = rule;
+    }
+}
+
+static char *read_at(int dir_fd, const char *name) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    char *text = malloc(st.st_size + 1);
+    ssize_t n = text ? read(fd, text, st.st_size) : -1;
+    close(fd);
+    if (n < 0) {
+        free(text);
+        return NULL;
+    }
+    text[n] = '\0';
+
+    return text;
+}
+
+// adds the rules of .gitignore and .ignore in the directory to parent
+static struct ignoreSet *load_ignores(struct walkState *state, int dir_fd,
+                                      const char *rel,
+                                      struct ignoreSet *parent) {
+    static const char *names[] = {".gitignore", ".ignore"};
+    struct ignoreSet *set = NULL;
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        char *text = read_at(dir_fd, names[i]);
+        if (!text)
+            continue;
+
+        if (!set) {
+            set = calloc(1, sizeof(*set));
+            if (!set || !(set->base = strdup(rel))) {
+                free(set);
+                free(text);
+                return parent;
+            }
+            set->parent = parent;
+        }
+        parse_ignore_file(set, text);
+        free(text);
+    }
+
+    if (!set)
+        return parent;
+
+    pthread_mutex_lock(&state->lock);
+    set->next_alloc = state->ignore_sets;
+    state->ignore_sets = set;
+    pthread_mutex_unlock(&state->lock);
+
+    return set;
+}
+
+// the innermost matching rule decides, and within one file the last one
+static int is_ignored(const struct ignoreSet *set, const char *rel,
+                      int is_dir) {
+    const char *name = strrchr(rel, '/');
+    name = name ? name + 1 : rel;
+
+    for (; set; set = set->parent) {
+        size_t base_len = strlen(set->base);
+        const char *sub = rel + base_len + (base_len > 0);
+
+        for (int i = set->count - 1; i >= 0; i--) {
+            const struct ignoreRule *rule = &set->rules[i];
+            if (rule->dir_only && !is_dir)
+                continue;
+
+            int matched = rule->anchored
+                                  ? fnmatch(rule->pattern, sub,
+                                            FNM_PATHNAME) == 0
+                                  : fnmatch(rule->pattern, name, 0) == 0;
+            if (matched)
+                return !rule->negate;
+        }
+    }
+
+    return 0;
+}
+
+static void push_dir(struct walkState *state, char *rel,
+                     struct ignoreSet *ignores) {
+    struct walkDir *dir = malloc(sizeof(*dir));
+    if (!dir) {
+        free(rel);
+        state->failed = 1;
+        return;
+    }
+    dir->rel = rel;
+    dir->ignores = ignores;
+
+    pthread_mutex_lock(&state->lock);
+    dir->next = state->queue;
+    state->queue = dir;
+    pthread_cond_signal(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+}
+
+static void flush_batch(struct walkState *state, char *batch, size_t *len,
+                        size_t *paths) {
+    if (*paths == 0)
+        return;
+
+    pthread_mutex_lock(&state->lock);
+    if (list_append_batch(state->list, batch, *len, *paths) == -1)
+        state->failed = 1;
+    pthread_mutex_unlock(&state->lock);
+
+    *len = 0;
+    *paths = 0;
+}
+
+static void walk_dir(struct walkState *state, struct walkDir *dir,
+                     char *dirents, char *batch) {
+    int fd = openat(state->root_fd, *dir->rel ? dir->rel : ".",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    struct ignoreSet *ignores = load_ignores(state, fd, dir->rel, dir->ignores);
+    size_t batch_len = 0;
+    size_t batch_paths = 0;
+
+    while (1) {
+        long n = syscall(SYS_getdents64, fd, dirents, DIRENT_BUF_SIZE);
+        if (n <= 0)
+            break;
+
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *ent =
+                    (struct linux_dirent64 *) (dirents + pos);
+            pos += ent->d_reclen;
+
+            const char *name = ent->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+                strcmp(name, ".git") == 0)
+                continue;
+
+            int type = ent->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR
+                       : S_ISREG(st.st_mode) ? DT_REG
+                                             : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && type != DT_REG)
+                continue;
+
+            char rel[PATH_MAX];
+            int len = snprintf(rel, sizeof(rel), "%s%s%s", dir->rel,
+                               *dir->rel ? "/" : "", name);
+            if (len < 0 || (size_t) len >= sizeof(rel))
+                continue;
+            if (is_ignored(ignores, rel, type == DT_DIR))
+                continue;
+
+            if (type == DT_DIR) {
+                char *copy = strdup(rel);
+                if (copy)
+                    push_dir(state, copy, ignores);
+                continue;
+            }
+
+            if (batch_len + len + 1 > PATH_BATCH_SIZE)
+                flush_batch(state, batch, &batch_len, &batch_paths);
+            memcpy(&batch[batch_len], rel, len + 1);
+            batch_len += len + 1;
+            batch_paths++;
+        }
+    }
+
+    flush_batch(state, batch, &batch_len, &batch_paths);
+    close(fd);
+}
+
+static void *walk_worker(void *arg) {
+    struct walkState *state = arg;
+    char *dirents = malloc(DIRENT_BUF_SIZE);
+    char *batch = malloc(PATH_BATCH_SIZE);
+
+    while (1) {
+        pthread_mutex_lock(&state->lock);
+        while (!state->queue && state->busy > 0)
+            pthread_cond_wait(&state->cond, &state->lock);
+        if (!state->queue) {
+            pthread_cond_broadcast(&state->cond);
+            pthread_mutex_unlock(&state->lock);
+            break;
+        }
+        struct walkDir *dir = state->queue;
+        state->queue = dir->next;
+        state->busy++;
+        pthread_mutex_unlock(&state->lock);
+
+        if (dirents && batch)
+            walk_dir(state, dir, dirents, batch);
+        else
+            state->failed = 1;
+        free(dir->rel);
+        free(dir);
+
+        pthread_mutex_lock(&state->lock);
+        state->busy--;
+        if (!state->queue && state->busy == 0)
+            pthread_cond_broadcast(&state->cond);
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    free(dirents);
+    free(batch);
+
+    return NULL;
+}
+
+// lists every file below root that no ignore file excludes, walking
+// directories on several threads
+int file_list_walk(struct FileList *list, const char *root) {
+    memset(list, 0, sizeof(*list));
+
+    struct walkState state = {.list = list};
+    state.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (state.root_fd == -1)
+        return -1;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    char *rel = strdup("");
+    if (rel)
+        push_dir(&state, rel, NULL);
+
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (workers > MAX_WALKERS)
+        workers = MAX_WALKERS;
+
+    pthread_t threads[MAX_WALKERS];
+    long started = 0;
+    while (started < workers &&
+           pthread_create(&threads[started], NULL, walk_worker, &state) == 0)
+        started++;
+    if (started == 0)
+        walk_worker(&state);
+    for (long i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    while (state.ignore_sets) {
+        struct ignoreSet *set = state.ignore_sets;
+        state.ignore_sets = set->next_alloc;
+        for (int i = 0; i < set->count; i++)
+            free(set->rules[i].pattern);
+        free(set->rules);
+        free(set->base);
+        free(set);
+    }
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.cond);
+    close(state.root_fd);
+
+    if (state.failed || !rel) {
+        file_list_free(list);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+void file_list_free(struct FileList *list) {
+    mem_free(list->arena);
+    mem_free(list->paths);
+    mem_free(list->masks);
+    memset(list, 0, sizeof(*list));
+}
+
+const char *file_list_path(const struct FileList *list, uint32_t file) {
+    return &list->arena[list->paths[file]];
+}
+
+// paths are stored back to back, so the next one starts after this one's NUL
+static size_t file_list_len(const struct FileList *list, uint32_t file) {
+    size_t end = file + 1 < list->count ? list->paths[file + 1]
+                                        : list->arena_len;
+    return end - list->paths[file] - 1;
+}
+
+// next occurrence of lower or upper at or after s, NULL if there is none
+// before end. reads up to 15 bytes past end, which the arena padding covers
+static const char *find_char(const char *s, const char *end, char lower,
+                             char upper) {
+#ifdef __SSE2__
+    __m128i lo = _mm_set1_epi8(lower);
+    __m128i up = _mm_set1_epi8(upper);
+    for (; s < end; s += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) s);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(chunk, lo), _mm_cmpeq_epi8(chunk, up)));
+        if (mask) {
+            const char *found = s + __builtin_ctz(mask);
+            return found < end ? found : NULL;
+        }
+    }
+    return NULL;
+#else
+    for (; s < end; s++) {
+        if (*s == lower || *s == upper)
+            return s;
+    }
+    return NULL;
+#endif
+}
+
+static int is_separator(char c) {
+    return c == '/' || c == '_' || c == '-' || c == '.' || c == ' ';
+}
+
+// scores a path the query is a subsequence of, -1 if it is not. the match
+// is found greedily, then tightened from its end backwards
+static int32_t score_path(const char *path, size_t len, const char *lower,
+                          const char *upper, size_t query_len) {
+    const char *end = path + len;
+    const char *p = path;
+    const char *last = NULL;
+
+    for (size_t i = 0; i < query_len; i++) {
+        p = find_char(p, end, lower[i], upper[i]);
+        if (!p)
+            return -1;
+        last = p++;
+    }
+
+    size_t positions[256];
+    const char *q = last;
+    for (size_t i = query_len; i-- > 0;) {
+        while (*q != lower[i] && *q != upper[i])
+            q--;
+        positions[i] = q - path;
+        q--;
+    }
+
+    const char *basename = strrchr(path, '/');
+    size_t base_start = basename ? (size_t) (basename - path) + 1 : 0;
+
+    int32_t score = 0;
+    for (size_t i = 0; i < query_len; i++) {
+        size_t pos = positions[i];
+        score += 16;
+        if (pos >= base_start)
+            score += 2;
+        if (pos == 0 || is_separator(path[pos - 1]))
+            score += pos == 0 || path[pos - 1] == '/' ? 12 : 10;
+        else if (islower((unsigned char) path[pos - 1]) &&
+                 isupper((unsigned char) path[pos]))
+            score += 4;
+        if (i > 0) {
+            size_t gap = pos - positions[i - 1] - 1;
+            score += gap == 0 ? 8 : -(int32_t) (gap < 8 ? gap : 8);
+        }
+    }
+
+    return score;
+}
+
+int finder_init(struct Finder *finder, const struct FileList *files,
+                size_t top) {
+    memset(finder, 0, sizeof(*finder));
+    finder->files = files;
+    finder->top_cap = top;
+    finder->matches = mem_malloc(MEM_INDEX, (files->count + 1) *
+                                                    sizeof(*finder->matches));
+    finder->top = mem_malloc(MEM_INDEX, (top + 1) * sizeof(*finder->top));
+    if (!finder->matches || !finder->top) {
+        finder_free(finder);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return finder_set_query(finder, "", 0);
+}
+
+void finder_free(struct Finder *finder) {
+    mem_free(finder->matches);
+    mem_free(finder->top);
+    memset(finder, 0, sizeof(*finder));
+}
+
+// keeps the best top matches from the next finder_set_query() on
+int finder_set_top(struct Finder *finder, size_t top) {
+    struct FinderMatch *matches =
+            mem_realloc(MEM_INDEX, finder->top, (top + 1) * sizeof(*matches));
+    if (!matches)
+        return -1;
+
+    finder->top = matches;
+    finder->top_cap = top;
+    if (finder->top_count > top)
+        finder->top_count = top;
+    return 0;
+}
+
+struct scoreChunk {
+    struct Finder *finder;
+    const char *lower;
+    const char *upper;
+    size_t len;
+    uint64_t mask;
+    int extends;
+    size_t start; // candidates [start, end) are scored, matches are written
+    size_t end;   // back from start
+    size_t count;
+    struct FinderMatch *top;
+    size_t top_count;
+};
+
+static void insert_top(const struct FileList *files, struct FinderMatch *top,
+                       size_t *top_count, size_t top_cap, uint32_t file,
+                       int32_t score, size_t len) {
+    size_t i = *top_count;
+    if (i == top_cap) {
+        if (top_cap == 0 || score <= top[i - 1].score)
+            return;
+        i--;
+    } else {
+        (*top_count)++;
+    }
+
+    // ties go to the shorter path
+    while (i > 0 && (top[i - 1].score < score ||
+                     (top[i - 1].score == score &&
+                      file_list_len(files, top[i - 1].file) > len))) {
+        top[i] = top[i - 1];
+        i--;
+    }
+    top[i] = (struct FinderMatch){.file = file, .score = score};
+}
+
+static void *score_chunk(void *arg) {
+    struct scoreChunk *chunk = arg;
+    struct Finder *finder = chunk->finder;
+    const struct FileList *files = finder->files;
+
+    for (size_t i = chunk->start; i < chunk->end; i++) {
+        uint32_t file = chunk->extends ? finder->matches[i] : (uint32_t) i;
+        if (chunk->mask & ~files->masks[file])
+            continue;
+
+        const char *path = file_list_path(files, file);
+        size_t path_len = file_list_len(files, file);
+        int32_t score = chunk->len ? score_path(path, path_len, chunk->lower,
+                                                chunk->upper, chunk->len)
+                                   : 0;
+        if (score < 0)
+            continue;
+
+        // never ahead of i, so this is safe when filtering in place
+        finder->matches[chunk->start + chunk->count++] = file;
+        insert_top(files, chunk->top, &chunk->top_count, finder->top_cap, file,
+                   score, path_len);
+    }
+
+    return NULL;
+}
+
+// when the query extends the previous one only the previous matches are
+// searched again. large candidate sets are split across threads
+int finder_set_query(struct Finder *finder, const char *query, size_t len) {
+    if (len >= sizeof(finder->query)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int extends = finder->query_len > 0 && len >= finder->query_len &&
+                  memcmp(query, finder->query, finder->query_len) == 0;
+    memcpy(finder->query, query, len);
+    finder->query[len] = '\0';
+    finder->query_len = len;
+
+    // smart case: an upper case letter in the query makes it case sensitive
+    int sensitive = 0;
+    for (size_t i = 0; i < len; i++)
+        sensitive |= isupper((unsigned char) query[i]) != 0;
+
+    char lower[256];
+    char upper[256];
+    for (size_t i = 0; i < len; i++) {
+        lower[i] = sensitive ? query[i] : tolower((unsigned char) query[i]);
+        upper[i] = sensitive ? query[i] : toupper((unsigned char) query[i]);
+    }
+
+    size_t candidates = extends ? finder->match_count : finder->files->count;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_SCORERS)
+        threads = MAX_SCORERS;
+    if ((size_t) threads > candidates / MIN_CHUNK_SIZE)
+        threads = candidates / MIN_CHUNK_SIZE;
+    if (threads < 1)
+        threads = 1;
+
+    struct scoreChunk chunks[MAX_SCORERS];
+    pthread_t ids[MAX_SCORERS];
+    int started[MAX_SCORERS];
+    for (long t = 0; t < threads; t++) {
+        chunks[t] = (struct scoreChunk){
+                .finder = finder,
+                .lower = lower,
+                .upper = upper,
+                .len = len,
+                .mask = char_mask(query, len),
+                .extends = extends,
+                .start = candidates * t / threads,
+                .end = candidates * (t + 1) / threads,
+                .top = t == 0 ? finder->top
+                              : mem_malloc(MEM_INDEX, finder->top_cap *
+                                                   sizeof(*finder->top)),
+        };
+        started[t] = 0;
+        if (t > 0 && chunks[t].top)
+            started[t] = pthread_create(&ids[t], NULL, score_chunk,
+                                        &chunks[t]) == 0;
+    }
+
+    score_chunk(&chunks[0]);
+    for (long t = 1; t < threads; t++) {
+        if (started[t])
+            pthread_join(ids[t], NULL);
+        else if (chunks[t].top)
+            score_chunk(&chunks[t]);
+        else
+            chunks[t].count = 0; // out of memory, the chunk is dropped
+    }
+
+    // close the gaps between the chunks' matches and merge their best ones
+    finder->match_count = chunks[0].count;
+    finder->top_count = chunks[0].top_count;
+    for (long t = 1; t < threads; t++) {
+        memmove(&finder->matches[finder->match_count],
+                &finder->matches[chunks[t].start],
+                chunks[t].count * sizeof(*finder->matches));
+        finder->match_count += chunks[t].count;
+
+        for (size_t i = 0; i < chunks[t].top_count; i++) {
+            struct FinderMatch match = chunks[t].top[i];
+            insert_top(finder->files, finder->top, &finder->top_count,
+                       finder->top_cap, match.file, match.score,
+                       file_list_len(finder->files, match.file));
+        }
+        mem_free(chunks[t].top);
+    }
+
+    return 0;
+}
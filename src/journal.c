@@ -0,0 +1,445 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mem.h"
+#include "util.h"
+
+static uint64_t record_checksum(const struct JournalRecord *record) {
+    struct JournalRecord copy = *record;
+    copy.checksum = 0;
+
+    uint64_t hash = util_hash(UTIL_HASH_SEED, &copy, sizeof(copy));
+    return util_hash(hash, record + 1, record->size);
+}
+
+// $XDG_STATE_HOME/LiteEdit/journal/<hash of the file's real path>.journal
+int journal_path(const char *filename, char *path, size_t size) {
+    char real_path[PATH_MAX];
+    if (!realpath(filename, real_path))
+        return -1;
+
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    uint64_t hash = util_hash(UTIL_HASH_SEED, real_path, strlen(real_path));
+    int len;
+
+    if (state && *state)
+        len = snprintf(path, size, "%s/LiteEdit/journal/%016llx.journal",
+                       state, (unsigned long long) hash);
+    else if (home)
+        len = snprintf(path, size,
+                       "%s/.local/state/LiteEdit/journal/%016llx.journal",
+                       home, (unsigned long long) hash);
+    else {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return util_make_dirs(path);
+}
+
+struct JournalHeader journal_header(int64_t base_size,
+                                    struct timespec base_mtime) {
+    struct JournalHeader header = {
+            .version = JOURNAL_VERSION,
+            .base_size = base_size,
+            .base_mtime_sec = base_mtime.tv_sec,
+            .base_mtime_nsec = base_mtime.tv_nsec,
+    };
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+
+    return header;
+}
+
+bool journal_header_matches(const struct JournalHeader *a,
+                            const struct JournalHeader *b) {
+    return a->base_size == b->base_size &&
+           a->base_mtime_sec == b->base_mtime_sec &&
+           a->base_mtime_nsec == b->base_mtime_nsec;
+}
+
+// returns the length of the intact record at offset, or 0
+static size_t check_record(const char *map, size_t size, size_t offset) {
+    if (size - offset < sizeof(struct JournalRecord))
+        return 0;
+
+    const struct JournalRecord *record = (const void *) (map + offset);
+    if ((record->type != JOURNAL_EDITS && record->type != JOURNAL_ROWS) ||
+        record->size > size - offset - sizeof(*record) ||
+        record->size % 8 != 0 ||
+        record->count > record->size / sizeof(struct JournalEdit) ||
+        record_checksum(record) != record->checksum)
+        return 0;
+
+    const struct JournalEdit *edits = (const void *) (record + 1);
+    uint64_t text_size = record->size - record->count * sizeof(*edits);
+    for (uint32_t i = 0; i < record->count; i++) {
+        if (edits[i].start > edits[i].end || edits[i].text > text_size ||
+            edits[i].len > text_size - edits[i].text)
+            return 0;
+    }
+
+    return sizeof(*record) + record->size;
+}
+
+int journal_read_open(struct JournalReader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < (off_t) sizeof(struct JournalHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const struct JournalHeader *header = map;
+    if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != JOURNAL_VERSION) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    reader->map = map;
+    reader->map_size = st.st_size;
+    mem_account(MEM_JOURNAL, st.st_size);
+    reader->header = header;
+    reader->offset = sizeof(*header);
+    reader->end = sizeof(*header);
+    size_t len;
+    while ((len = check_record(map, st.st_size, reader->end))) {
+        reader->end += len;
+        reader->records++;
+    }
+
+    return 0;
+}
+
+bool journal_read_next(struct JournalReader *reader,
+                       const struct JournalRecord **record,
+                       const struct JournalEdit **edits, const char **text) {
+    if (reader->offset >= reader->end)
+        return false;
+
+    *record = (const void *) ((const char *) reader->map + reader->offset);
+    *edits = (const void *) (*record + 1);
+    *text = (const char *) (*edits + (*record)->count);
+    reader->offset += sizeof(**record) + (*record)->size;
+
+    return true;
+}
+
+void journal_read_close(struct JournalReader *reader) {
+    if (reader->map) {
+        munmap(reader->map, reader->map_size);
+        mem_account(MEM_JOURNAL, -(int64_t) reader->map_size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+// appends a record of edits to buf, the edits' text is gathered from text
+static int queue_record(char **buf, size_t *len, size_t *cap, uint32_t type,
+                        const struct JournalEdit *edits, size_t count,
+                        const char *text) {
+    if (count > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t text_len = 0;
+    for (size_t i = 0; i < count; i++)
+        text_len += edits[i].len;
+    size_t size = count * sizeof(struct JournalEdit) + text_len;
+    size = (size + 7) & ~(size_t) 7; // keeps the next record aligned
+
+    size_t need = *len + sizeof(struct JournalRecord) + size;
+    if (need > *cap) {
+        size_t grown = *cap ? *cap * 2 : 4096;
+        if (grown < need)
+            grown = need;
+        char *p = mem_realloc(MEM_JOURNAL, *buf, grown);
+        if (!p)
+            return -1;
+        *buf = p;
+        *cap = grown;
+    }
+
+    struct JournalRecord *record = (void *) (*buf + *len);
+    *record = (struct JournalRecord){
+            .type = type,
+            .count = count,
+            .size = size,
+    };
+    struct JournalEdit *packed = (void *) (record + 1);
+    char *out = (char *) (packed + count);
+    size_t at = 0;
+    for (size_t i = 0; i < count; i++) {
+        packed[i] = edits[i];
+        packed[i].text = at;
+        if (edits[i].len > 0)
+            memcpy(out + at, text + edits[i].text, edits[i].len);
+        at += edits[i].len;
+    }
+    memset(out + at, 0, size - count * sizeof(*packed) - at);
+    record->checksum = record_checksum(record);
+    *len = need;
+
+    return 0;
+}
+
+// creates the file on the first write, or continues the intact part of the
+// one that was replayed
+static int open_journal(struct Journal *journal) {
+    journal->fd = open(journal->path, O_WRONLY | O_CREAT, 0600);
+    if (journal->fd == -1)
+        return -1;
+
+    if (ftruncate(journal->fd, journal->keep) == -1)
+        return -1;
+    if (journal->keep > 0)
+        return lseek(journal->fd, journal->keep, SEEK_SET) == -1 ? -1 : 0;
+    return util_write_all(journal->fd, &journal->header,
+                          sizeof(journal->header));
+}
+
+// a rename is only durable once the directory holding it is synced
+static int sync_parent(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t) (slash - path) : 0;
+    if (len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+
+    int fd = open(len ? dir : slash ? "/" : ".",
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    int result = fsync(fd);
+    close(fd);
+
+    return result;
+}
+
+// written next to the journal and renamed over it, so a crash leaves either
+// the old or the new one
+static int replace_journal(struct Journal *journal, const char *data,
+                           size_t len) {
+    char tmp_path[sizeof(journal->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return -1;
+
+    if (util_write_all(fd, data, len) == -1 || fdatasync(fd) == -1 ||
+        rename(tmp_path, journal->path) == -1) {
+        int error = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+
+    if (journal->fd != -1)
+        close(journal->fd);
+    journal->fd = fd;
+
+    return sync_parent(journal->path);
+}
+
+static void *journal_writer(void *arg) {
+    struct Journal *journal = arg;
+    char *batch = NULL;
+    size_t batch_cap = 0;
+
+    pthread_mutex_lock(&journal->lock);
+    while (true) {
+        while (!journal->stop && journal->pending_len == 0 &&
+               !journal->compacted)
+            pthread_cond_wait(&journal->wake, &journal->lock);
+        if (journal->pending_len == 0 && !journal->compacted)
+            break;
+
+        // the UI thread queues into the other buffer while this one is
+        // written
+        char *compacted = journal->compacted;
+        size_t compacted_len = journal->compacted_len;
+        char *records = journal->pending;
+        size_t records_cap = journal->pending_cap;
+        size_t len = journal->pending_len;
+        bool failed = journal->error != 0;
+        journal->compacted = NULL;
+        journal->pending = batch;
+        journal->pending_cap = batch_cap;
+        journal->pending_len = 0;
+        batch = records;
+        batch_cap = records_cap;
+        pthread_mutex_unlock(&journal->lock);
+
+        int error = 0;
+        if (compacted) {
+            if (replace_journal(journal, compacted, compacted_len) == -1)
+                error = errno;
+            else
+                failed = false;
+            mem_free(compacted);
+        }
+        if (!failed && !error && len > 0 &&
+            ((journal->fd == -1 && open_journal(journal) == -1) ||
+             util_write_all(journal->fd, records, len) == -1 ||
+             fdatasync(journal->fd) == -1))
+            error = errno;
+
+        pthread_mutex_lock(&journal->lock);
+        if (compacted || error)
+            journal->error = error;
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    mem_free(batch);
+    return NULL;
+}
+
+// keep is the replayed journal to continue, or NULL to start a new one
+int journal_start(struct Journal *journal, const char *path,
+                  const struct JournalHeader *header,
+                  const struct JournalReader *keep) {
+    *journal = (struct Journal){
+            .header = *header,
+            .fd = -1,
+    };
+    if (strlen(path) >= sizeof(journal->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(journal->path, path);
+    if (keep) {
+        journal->keep = keep->end;
+        journal->records = keep->records;
+        journal->size = keep->end - sizeof(struct JournalHeader);
+    }
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    int error = pthread_create(&journal->thread, NULL, journal_writer, journal);
+    if (error) {
+        pthread_mutex_destroy(&journal->lock);
+        pthread_cond_destroy(&journal->wake);
+        errno = error;
+        return -1;
+    }
+    journal->started = true;
+
+    return 0;
+}
+
+// queues a record for the writer, the UI thread only copies the edits
+int journal_append(struct Journal *journal, uint32_t type,
+                   const struct JournalEdit *edits, size_t count,
+                   const char *text) {
+    if (!journal->started)
+        return 0;
+
+    pthread_mutex_lock(&journal->lock);
+    int error = journal->compacted ? 0 : journal->error;
+    size_t len = journal->pending_len;
+    if (!error && queue_record(&journal->pending, &journal->pending_len,
+                               &journal->pending_cap, type, edits, count,
+                               text) == -1)
+        error = errno;
+    if (!error) {
+        journal->records++;
+        journal->size += journal->pending_len - len;
+        pthread_cond_signal(&journal->wake);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+// replaces the journal with header and a record of edits, which must cover
+// everything queued so far
+int journal_compact(struct Journal *journal,
+                    const struct JournalHeader *header, uint32_t type,
+                    const struct JournalEdit *edits, size_t count,
+                    const char *text) {
+    if (!journal->started)
+        return 0;
+
+    size_t len = sizeof(*header);
+    size_t cap = len;
+    char *data = mem_malloc(MEM_JOURNAL, cap);
+    if (!data)
+        return -1;
+    memcpy(data, header, sizeof(*header));
+    if (count > 0 &&
+        queue_record(&data, &len, &cap, type, edits, count, text) == -1) {
+        mem_free(data);
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    mem_free(journal->compacted);
+    journal->compacted = data;
+    journal->compacted_len = len;
+    journal->pending_len = 0; // the records are part of the compacted one
+    journal->records = count > 0;
+    journal->size = 0;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+
+    return 0;
+}
+
+// writes what is still queued. remove deletes the journal, for buffers
+// that have nothing left to recover
+void journal_close(struct Journal *journal, bool remove) {
+    if (!journal->started)
+        return;
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = true;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->thread, NULL);
+
+    if (journal->fd != -1)
+        close(journal->fd);
+    if (remove)
+        unlink(journal->path);
+    mem_free(journal->pending);
+    mem_free(journal->compacted);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->wake);
+    *journal = (struct Journal){.fd = -1};
+}
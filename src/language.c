@@ -0,0 +1,328 @@
+#include "language.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "queries.h"
+
+const TSLanguage *tree_sitter_c(void);
+
+#define LANGUAGE(...)                                                          \
+    {                                                                          \
+        __VA_ARGS__, .grammar_lock = PTHREAD_MUTEX_INITIALIZER,                \
+                     .query_lock = PTHREAD_MUTEX_INITIALIZER,                  \
+                     .tags_lock = PTHREAD_MUTEX_INITIALIZER,                   \
+    }
+
+#define LIST(...)                                                              \
+    (const char *const[]) {                                                    \
+        __VA_ARGS__, NULL                                                      \
+    }
+
+// grammars without a bundled parser are loaded from
+// $XDG_DATA_HOME/LiteEdit/grammars/<name>.so on first use
+static struct Language languages[] = {
+        LANGUAGE(.name = "c", .extensions = LIST("c", "h"),
+                 .shebangs = LIST(NULL), .grammar = tree_sitter_c,
+                 .highlights = query_c_highlights,
+                 .highlights_len = &query_c_highlights_len,
+                 .tags = query_c_tags, .tags_len = &query_c_tags_len),
+        LANGUAGE(.name = "cpp",
+                 .extensions = LIST("cc", "cpp", "cxx", "hh", "hpp", "hxx"),
+                 .shebangs = LIST(NULL)),
+        LANGUAGE(.name = "python", .extensions = LIST("py", "pyi"),
+                 .shebangs = LIST("python", "python3")),
+        LANGUAGE(.name = "bash", .extensions = LIST("sh", "bash"),
+                 .shebangs = LIST("sh", "bash")),
+        LANGUAGE(.name = "javascript", .extensions = LIST("js", "mjs", "cjs"),
+                 .shebangs = LIST("node")),
+        LANGUAGE(.name = "json", .extensions = LIST("json"),
+                 .shebangs = LIST(NULL)),
+        LANGUAGE(.name = "rust", .extensions = LIST("rs"),
+                 .shebangs = LIST(NULL)),
+};
+
+static char *tree_sitter_options[] = {
+        "function", "function.builtin", "type",        "type.builtin",
+        "keyword",  "keyword.control",  "variable",    "variable.parameter",
+        "constant", "constant.builtin", "string",      "comment",
+        "number",   "operator",         "punctuation", "label",
+        NULL, // Null-terminated array
+};
+
+static int list_contains(const char *const *list, const char *str,
+                         size_t len) {
+    for (int i = 0; list[i] != NULL; i++) {
+        if (strlen(list[i]) == len && strncmp(list[i], str, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+// "#!/usr/bin/env python3 -u" -> "python3"
+static const char *shebang_interpreter(const char *text, size_t len,
+                                       size_t *name_len) {
+    if (len < 2 || text[0] != '#' || text[1] != '!')
+        return NULL;
+
+    const char *line_end = memchr(text, '\n', len);
+    const char *end = line_end ? line_end : text + len;
+    const char *p = text + 2;
+
+    const char *name = NULL;
+    for (int word = 0; word < 2; word++) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+
+        name = start;
+        for (const char *c = start; c < p; c++) {
+            if (*c == '/')
+                name = c + 1;
+        }
+        *name_len = p - name;
+
+        if (*name_len != 3 || strncmp(name, "env", 3) != 0)
+            break;
+    }
+
+    // python3.12 is still python3
+    for (size_t i = 0; i < *name_len; i++) {
+        if (name[i] == '.') {
+            *name_len = i;
+            break;
+        }
+    }
+
+    return *name_len > 0 ? name : NULL;
+}
+
+struct Language *language_detect(const char *path, const char *text,
+                                 size_t len) {
+    int count = sizeof(languages) / sizeof(languages[0]);
+
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *ext = strrchr(base, '.');
+    if (ext && ext != base) {
+        for (int i = 0; i < count; i++) {
+            if (list_contains(languages[i].extensions, ext + 1,
+                              strlen(ext + 1)))
+                return &languages[i];
+        }
+    }
+
+    size_t name_len;
+    const char *interpreter = shebang_interpreter(text, len, &name_len);
+    if (interpreter) {
+        for (int i = 0; i < count; i++) {
+            if (list_contains(languages[i].shebangs, interpreter, name_len))
+                return &languages[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void *open_grammar(const char *name, const TSLanguage **ts_language) {
+    char path[4096];
+    const char *data = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+
+    if (data && *data)
+        snprintf(path, sizeof(path), "%s/LiteEdit/grammars/%s.so", data, name);
+    else if (home)
+        snprintf(path, sizeof(path), "%s/.local/share/LiteEdit/grammars/%s.so",
+                 home, name);
+    else
+        return NULL;
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        return NULL;
+
+    char symbol[128];
+    snprintf(symbol, sizeof(symbol), "tree_sitter_%s", name);
+
+    const TSLanguage *(*grammar)(void);
+    *(void **) &grammar = dlsym(handle, symbol);
+    if (!grammar) {
+        dlclose(handle);
+        return NULL;
+    }
+
+    *ts_language = grammar();
+    return handle;
+}
+
+// safe to call from any thread, the grammar is only loaded once
+const TSLanguage *language_grammar(struct Language *lang) {
+    pthread_mutex_lock(&lang->grammar_lock);
+    if (!lang->grammar_loaded) {
+        if (lang->grammar)
+            lang->ts_language = lang->grammar();
+        else
+            lang->handle = open_grammar(lang->name, &lang->ts_language);
+        lang->grammar_loaded = 1;
+    }
+    pthread_mutex_unlock(&lang->grammar_lock);
+
+    return lang->ts_language;
+}
+
+// reads $XDG_CONFIG_HOME/LiteEdit/tree-sitter/<lang>/<name>, which
+// overrides the bundled query. returns NULL if there is none
+char *language_read_user_query(const char *lang, const char *name, long *len) {
+    char path[4096];
+    const char *config = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+
+    if (config && *config)
+        snprintf(path, sizeof(path), "%s/LiteEdit/tree-sitter/%s/%s", config,
+                 lang, name);
+    else if (home)
+        snprintf(path, sizeof(path), "%s/.config/LiteEdit/tree-sitter/%s/%s",
+                 home, lang, name);
+    else
+        return NULL;
+
+    FILE *query_file = fopen(path, "r");
+    if (!query_file)
+        return NULL;
+
+    fseek(query_file, 0, SEEK_END);
+    long query_size = ftell(query_file);
+    fseek(query_file, 0, SEEK_SET);
+
+    char *query_string = malloc(query_size + 1);
+    if (!query_string) {
+        fclose(query_file);
+        return NULL;
+    }
+
+    *len = fread(query_string, 1, query_size, query_file);
+    query_string[*len] = '\0';
+
+    fclose(query_file);
+
+    return query_string;
+}
+
+static HighlightType get_highlight_type(const char *capture_name,
+                                        uint32_t len) {
+    int match_len = 0;
+    int match_index = -1;
+
+    int i = 0;
+    while (tree_sitter_options[i] != NULL) {
+        const char *str = tree_sitter_options[i];
+        int this_match_len = 1;
+
+        int index = 0;
+        while (1) {
+            if (str[index] == '\0' || (uint32_t) index >= len) {
+                break;
+            }
+            if (str[index] != capture_name[index]) {
+                this_match_len--;
+                break;
+            }
+            if (str[index] == '.') {
+                this_match_len++;
+            }
+
+            index++;
+        }
+
+        if (this_match_len > match_len) {
+            match_len = this_match_len;
+            match_index = i;
+        }
+        i++;
+    }
+
+    if (match_index >= 0)
+        return (HighlightType) match_index + 1;
+
+
+    return HL_NORMAL;
+}
+
+static TSQuery *load_query(struct Language *lang,
+                           const TSLanguage *ts_language, const char *name,
+                           const char *bundled, const size_t *bundled_len) {
+    uint32_t error_offset;
+    TSQueryError error_type;
+    TSQuery *query = NULL;
+
+    long query_size;
+    char *query_string =
+            language_read_user_query(lang->name, name, &query_size);
+    if (query_string) {
+        query = ts_query_new(ts_language, query_string, query_size,
+                             &error_offset, &error_type);
+        free(query_string);
+    }
+
+    // a broken override falls back to the bundled query
+    if (!query && bundled)
+        query = ts_query_new(ts_language, bundled, *bundled_len, &error_offset,
+                             &error_type);
+
+    return query;
+}
+
+// compiles the highlight query and maps its captures to highlight types.
+// safe to call from any thread, the work is only done once per language
+TSQuery *language_highlight_query(struct Language *lang) {
+    pthread_mutex_lock(&lang->query_lock);
+    if (!lang->query_loaded) {
+        const TSLanguage *ts_language = language_grammar(lang);
+        TSQuery *query = ts_language
+                                 ? load_query(lang, ts_language,
+                                              "highlights.scm",
+                                              lang->highlights,
+                                              lang->highlights_len)
+                                 : NULL;
+
+        if (query) {
+            uint32_t count = ts_query_capture_count(query);
+            lang->capture_types = malloc(sizeof(HighlightType) * (count + 1));
+            if (lang->capture_types) {
+                for (uint32_t id = 0; id < count; id++) {
+                    uint32_t len;
+                    const char *name =
+                            ts_query_capture_name_for_id(query, id, &len);
+                    lang->capture_types[id] = get_highlight_type(name, len);
+                }
+                lang->highlight_query = query;
+            } else {
+                ts_query_delete(query);
+            }
+        }
+        lang->query_loaded = 1;
+    }
+    pthread_mutex_unlock(&lang->query_lock);
+
+    return lang->highlight_query;
+}
+
+// the query the symbol index extracts definitions with
+TSQuery *language_tags_query(struct Language *lang) {
+    pthread_mutex_lock(&lang->tags_lock);
+    if (!lang->tags_loaded) {
+        const TSLanguage *ts_language = language_grammar(lang);
+        if (ts_language)
+            lang->tags_query = load_query(lang, ts_language, "tags.scm",
+                                          lang->tags, lang->tags_len);
+        lang->tags_loaded = 1;
+    }
+    pthread_mutex_unlock(&lang->tags_lock);
+
+    return lang->tags_query;
+}
@@ -1,17 +1,52 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "diff.h"
+#include "finder.h"
+#include "journal.h"
+#include "language.h"
+#include "mem.h"
+#include "snapshot.h"
+#include "symbols.h"
 #include "terminal.h"
 #include "tree_sitter/api.h"
+#include "util.h"
+#include "wrap.h"
 
 #define clamp(x, min, max) (x)<(min) ? (min) : (x)>(max) ? (max) : (x)
 #define ctrl(k) ((k) & 0x1f)
+#define TAB_STOP 4
+#define CHECKPOINT_INTERVAL 4096
+// how long a reparse may block the UI before it moves to the background
+#define PARSE_BUDGET_US 10000
+// past this many separate regions a commit edits the tree as one range
+#define MAX_TREE_EDITS 256
+// bytes journaled before it is rewritten as the rows that differ from disk
+#define JOURNAL_COMPACT_SIZE (256 * 1024)
+// how much of the start of a file the highlight snapshot covers
+#define SNAPSHOT_ROWS 256
+#define SNAPSHOT_BYTES (256 * 1024)
 #define STX_COLOR(x, y)                                                        \
     (Style) { .fg = (x), .bg = ST_INHERIT, .attr = (y) }
 
 #define CL_BASE 0x1a1b26
 #define CL_TEXT 0xc0caf5
 
+#define CL_ADDED 0x9ece6a
+#define CL_CHANGED 0xe0af68
+#define CL_REMOVED 0xf7768e
+
 #define CL_SURFACE 0x1f1d2e
 #define CL_OVERLAY 0x26233a
 #define CL_MUTED 0x6e6a86
@@ -35,8 +70,6 @@
 #define ST_PUNCTUATION STX_COLOR(0xc0caf5, 0)
 #define ST_LABEL STX_COLOR(0x7aa2f7, 0)
 
-const TSLanguage *tree_sitter_c(void);
-
 enum color { FG = 1, BG };
 
 typedef enum {
@@ -44,40 +77,89 @@ typedef enum {
     VERTICAL,
 } direction;
 
-char *tree_sitter_options[] = {
-        "function", "function.builtin", "type",        "type.builtin",
-        "keyword",  "keyword.control",  "variable",    "variable.parameter",
-        "constant", "constant.builtin", "string",      "comment",
-        "number",   "operator",         "punctuation", "label",
-        NULL, // Null-terminated array
+// the display column a byte offset of a row starts at
+struct colCheckpoint {
+    size_t byte;
+    size_t col;
 };
 
-
-typedef enum {
-    HL_NORMAL = 0,
-    HL_FUNCTION,
-    HL_FUNCTION_BUILTIN,
-    HL_TYPE,
-    HL_TYPE_BUILTIN,
-    HL_KEYWORD,
-    HL_KEYWORD_CONTROL,
-    HL_VARIABLE,
-    HL_VARIABLE_PARAMETER,
-    HL_CONSTANT,
-    HL_CONSTANT_BUILTIN,
-    HL_STRING,
-    HL_COMMENT,
-    HL_NUMBER,
-    HL_OPERATOR,
-    HL_PUNCTUATION,
-    HL_LABEL,
-} HighlightType;
+struct rowCheckpoints {
+    size_t count;
+    size_t cap;
+    bool done; // the checkpoints reach the end of the row
+    struct colCheckpoint at[];
+};
 
 typedef struct {
     size_t size;
-    char *chars;
+    size_t start; // offset in the text, read it with editorRowStart()
+    // one checkpoint every CHECKPOINT_INTERVAL bytes, so columns deep into a
+    // long line are found without scanning it from the start. only built for
+    // long rows and only as far as the view has been
+    struct rowCheckpoints *checkpoints;
 } erow;
 
+// the visible part of the row on a screen line
+struct rowWindow {
+    int row;          // file row on this screen line, -1 past the end
+    size_t first_col; // display column at the left edge of the text area
+    size_t start;     // byte range of the characters on screen
+    size_t end;
+    size_t col; // display column of start, at or left of first_col
+};
+
+// work running on its own thread. the worker bumps stage as results become
+// available and the UI thread picks them up in editorPollJobs()
+struct backgroundJob {
+    pthread_t thread;
+    bool pending;
+    atomic_int stage;
+    int seen;
+};
+
+// replaces the bytes [start, end) of the text with len bytes at offset text
+// of the transaction's arena
+struct editorEdit {
+    size_t start;
+    size_t end;
+    size_t text;
+    size_t len;
+    size_t order; // keeps edits at the same position in the order given
+};
+
+// edits collected with editorTransactionReplace() and applied at once by
+// editorCommit(): one pass over the text, one reparse, one undo step
+struct editorTransaction {
+    struct editorEdit *edits;
+    size_t count;
+    size_t cap;
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+};
+
+// the edits of a commit that lie within the same rows
+struct editRegion {
+    int first_row; // rows [first_row, last_row) are replaced
+    int last_row;
+    size_t start; // byte range of those rows, including the last newline
+    size_t end;
+    size_t first_edit; // edits [first_edit, last_edit) fall in the rows
+    size_t last_edit;
+    int64_t delta; // change in size
+};
+
+struct undoStack {
+    struct editorTransaction *entries; // each restores the text before a commit
+    size_t count;
+    size_t cap;
+};
+
+enum loadStage {
+    LOAD_ROWS = 1, // every line is indexed
+    LOAD_TREE,     // the first full parse is done
+};
+
 
 struct editorConfig {
     int cx, cy;
@@ -90,14 +172,89 @@ struct editorConfig {
     int screen_cols;
     int screen_rows;
     int num_rows;
+    char *filename;
+    dev_t file_dev;
+    ino_t file_ino;
     char *text;
     int len_text;
+    size_t text_cap;  // bytes text can grow to in place
+    bool text_mapped; // text is the file's mapping, until the load job read it
     erow *row;
+    // rows from shift_row on start shift_delta bytes after their start says.
+    // an edit only moves this boundary, see editorShiftRows()
+    int shift_row;
+    int64_t shift_delta;
+    struct rowWindow *windows; // one per text row, set by editorDrawLines
+    uint64_t *hashes; // hash of every row, NULL until the load job indexed them
+    bool wrap;
+    struct WrapLayout layout; // display lines per row, only in wrap mode
+    size_t row_sub; // wrapped line of row_offset at the top of the screen
     TSParser *parser;
     TSTree *tree;
-    TSQuery *highlight_query;
-    const TSLanguage *language;
+    struct backgroundJob reparse_job; // owns parser while it runs
+    char *reparse_text; // copy of the text the job parses
+    size_t reparse_len;
+    TSTree *reparse_old;
+    TSTree *reparsed_tree;
+    TSInputEdit *tree_edits; // edits made while reparse_job was running
+    size_t tree_edit_count;
+    size_t tree_edit_cap;
+    struct undoStack undo;
+    struct undoStack redo;
+    bool insert_mode;
+    bool prompt_active;
+    char prompt[256];
+    int prompt_len;
+    char status[128]; // shown on the bottom line until the next key
+    struct Language *lang;
+    bool highlighting; // lang's highlight query is compiled
+    struct Snapshot snapshot; // painted until highlighting is possible
     bool needs_redraw;
+    struct backgroundJob query_job;
+    struct backgroundJob load_job;
+    int load_fd;       // the file, read by load_job, or -1
+    char *loaded_text; // owned by load_job until LOAD_ROWS
+    size_t loaded_len;
+    size_t loaded_cap;
+    erow *loaded_row;
+    uint64_t *loaded_hashes;
+    int loaded_num_rows;
+    TSParser *loaded_parser; // owned by load_job until LOAD_TREE
+    TSTree *loaded_tree;
+    struct Diff diff; // rows changed since the file was last saved
+    struct backgroundJob diff_job;
+    bool diff_dirty; // rows changed while diff_job was running
+    struct Diff loaded_diff; // owned by diff_job, like everything below
+    bool diff_complete;      // loaded_diff lists every row that changed
+    uint64_t *diff_hashes;   // snapshot of hashes the diff runs on
+    size_t diff_count;
+    size_t diff_cap;
+    size_t diff_from; // rows [diff_from, diff_count - diff_tail) were edited
+    size_t diff_tail; // since the snapshot was taken
+    uint64_t *base_hashes; // rows of the file on disk
+    size_t base_count;
+    struct timespec base_mtime;
+    off_t base_size;
+    bool base_newline; // the file on disk ends with a newline
+    struct Journal journal;
+    struct JournalReader recovery; // offered for replay until answered
+    struct SymbolIndex symbols;
+    struct backgroundJob index_job;
+    struct SymbolIndex loaded_symbols; // owned by index_job until it is done
+    char symbols_path[4096];
+    char symbols_root[4096]; // the project indexed, empty until ctrl-]
+    struct FileList files;
+    struct backgroundJob walk_job;
+    struct FileList loaded_files; // owned by walk_job until it is done
+    struct Finder finder;
+    bool picker_active;
+    char picker_query[256];
+    int picker_query_len;
+    int picker_selected;
+    double picker_ms; // how long the last search took
+    struct timespec start_time;
+    double first_frame_ms;
+    double highlighted_frame_ms;
 };
 
 struct editorConfig E;
@@ -123,34 +280,243 @@ void enableRawMode() {
 }
 
 
+// decodes the UTF-8 character at s, invalid bytes decode one at a time to
+// U+FFFD. returns its length in bytes
+size_t decodeChar(const char *s, size_t len, wchar_t *ch) {
+    unsigned char c = s[0];
+    size_t n = c < 0x80                ? 1
+               : (c & 0xe0) == 0xc0 ? 2
+               : (c & 0xf0) == 0xe0 ? 3
+               : (c & 0xf8) == 0xf0 ? 4
+                                      : 0;
+    if (n == 1) {
+        *ch = c;
+        return 1;
+    }
+    if (n == 0 || n > len) {
+        *ch = 0xfffd;
+        return 1;
+    }
+
+    wchar_t value = c & (0x7f >> n);
+    for (size_t i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            *ch = 0xfffd;
+            return 1;
+        }
+        value = (value << 6) | (s[i] & 0x3f);
+    }
+    *ch = value;
+
+    return n;
+}
+
+size_t charWidth(wchar_t ch, size_t col) {
+    return ch == '\t' ? TAB_STOP - col % TAB_STOP : 1;
+}
+
+// the byte offset of row in the text, the end of the text past the last row
+size_t editorRowStart(int row) {
+    if (row >= E.num_rows)
+        return E.len_text;
+
+    return E.row[row].start + (row >= E.shift_row ? E.shift_delta : 0);
+}
+
+// the bytes of row, which is one of E.row
+const char *editorRowChars(const erow *row) {
+    return E.text + editorRowStart(row - E.row);
+}
+
+// extends the row's checkpoints until one lies past byte or col
+void editorRowCheckpoint(erow *row, size_t byte, size_t col) {
+    if (row->size < CHECKPOINT_INTERVAL)
+        return;
+
+    const char *chars = editorRowChars(row);
+    struct rowCheckpoints *cp = row->checkpoints;
+    if (!cp) {
+        cp = mem_malloc(MEM_ROWS,
+                        sizeof(*cp) + sizeof(struct colCheckpoint) * 16);
+        if (!cp)
+            die("malloc");
+        cp->count = 1;
+        cp->cap = 16;
+        cp->done = false;
+        cp->at[0] = (struct colCheckpoint){0, 0};
+        row->checkpoints = cp;
+    }
+
+    while (!cp->done) {
+        struct colCheckpoint last = cp->at[cp->count - 1];
+        if (last.byte > byte || last.col > col)
+            break;
+
+        size_t pos = last.byte;
+        size_t c = last.col;
+        while (pos < row->size && pos < last.byte + CHECKPOINT_INTERVAL) {
+            wchar_t ch;
+            pos += decodeChar(&chars[pos], row->size - pos, &ch);
+            c += charWidth(ch, c);
+        }
+        if (pos >= row->size) {
+            cp->done = true;
+            break;
+        }
+
+        if (cp->count == cp->cap) {
+            cp->cap *= 2;
+            cp = mem_realloc(MEM_ROWS, cp,
+                             sizeof(*cp) +
+                                     sizeof(struct colCheckpoint) * cp->cap);
+            if (!cp)
+                die("realloc");
+            row->checkpoints = cp;
+        }
+        cp->at[cp->count++] = (struct colCheckpoint){pos, c};
+    }
+}
+
+// the last checkpoint at or before both byte and col
+struct colCheckpoint editorRowFindCheckpoint(erow *row, size_t byte,
+                                             size_t col) {
+    editorRowCheckpoint(row, byte, col);
+
+    struct rowCheckpoints *cp = row->checkpoints;
+    if (!cp)
+        return (struct colCheckpoint){0, 0};
+
+    size_t lo = 0;
+    size_t hi = cp->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cp->at[mid].byte <= byte && cp->at[mid].col <= col)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return cp->at[lo];
+}
+
+// finds the character covering display column col and returns its byte
+// offset, *start_col is set to the column it starts at
+size_t editorRowColToByte(erow *row, size_t col, size_t *start_col) {
+    struct colCheckpoint from = editorRowFindCheckpoint(row, SIZE_MAX, col);
+    const char *chars = editorRowChars(row);
+
+    size_t pos = from.byte;
+    size_t c = from.col;
+    while (pos < row->size) {
+        wchar_t ch;
+        size_t n = decodeChar(&chars[pos], row->size - pos, &ch);
+        size_t w = charWidth(ch, c);
+        if (c + w > col)
+            break;
+        pos += n;
+        c += w;
+    }
+    *start_col = c;
+
+    return pos;
+}
+
+size_t editorRowByteToCol(erow *row, size_t byte) {
+    if (byte > row->size)
+        byte = row->size;
+    struct colCheckpoint from = editorRowFindCheckpoint(row, byte, SIZE_MAX);
+    const char *chars = editorRowChars(row);
+
+    size_t pos = from.byte;
+    size_t c = from.col;
+    while (pos < byte) {
+        wchar_t ch;
+        pos += decodeChar(&chars[pos], row->size - pos, &ch);
+        c += charWidth(ch, c);
+    }
+
+    return c;
+}
+
+void editorFreeRows(erow *rows, int num_rows) {
+    for (int i = 0; i < num_rows; i++)
+        mem_free(rows[i].checkpoints);
+    mem_free(rows);
+}
+
+// draws the characters of screen line y's window that lie in [from, to)
+void editorDrawWindow(int y, size_t from, size_t to, Style style) {
+    struct rowWindow *window = &E.windows[y];
+    erow *row = &E.row[window->row];
+    const char *chars = editorRowChars(row);
+    int text_cols = E.screen_cols - E.x_start_offset - E.x_end_offset;
+
+    if (to > window->end)
+        to = window->end;
+
+    size_t pos = window->start;
+    size_t col = window->col;
+    while (pos < to) {
+        wchar_t ch;
+        size_t n = decodeChar(&chars[pos], row->size - pos, &ch);
+        size_t w = charWidth(ch, col);
+        if (pos >= from) {
+            for (size_t i = 0; i < w; i++) {
+                int64_t x = (int64_t) (col + i) - window->first_col;
+                if (x >= 0 && x < text_cols)
+                    terminal_cell_set(x + E.x_start_offset,
+                                      y + E.y_start_offset,
+                                      (struct Cell){
+                                              .ch = ch == '\t' ? ' ' : ch,
+                                              .s = style,
+                                      });
+            }
+        }
+        pos += n;
+        col += w;
+    }
+}
+
+// only the columns on screen are decoded, however long the line is. in
+// wrap mode a row continues on the following screen lines
 void editorDrawLines() {
+    int text_cols = E.screen_cols - E.x_start_offset - E.x_end_offset;
+    int filerow = E.row_offset;
+    size_t sub = E.wrap ? E.row_sub : 0;
+
     for (int y = 0; y < E.screen_rows - E.y_start_offset - E.y_end_offset;
          y++) {
-        int filerow = y + E.row_offset;
+        struct rowWindow *window = &E.windows[y];
+        window->row = -1;
         if (filerow < E.num_rows) {
-            char ln[5];
-            int len_ln = 0;
-            len_ln += sprintf(ln, "%d", filerow);
-
-            size_t len = E.row[y + E.row_offset].size - E.col_offset;
-            if (len < 0)
-                len = 0;
-            if (len > E.screen_cols - E.x_start_offset - E.x_end_offset)
-                len = E.screen_cols - E.x_start_offset - E.x_end_offset;
-
-            for (int x = 0;
-                 x < E.screen_cols - E.x_start_offset - E.x_end_offset; x++) {
-                int rx = x + E.col_offset;
-                terminal_cell_set(
-                        x + E.x_start_offset, y + E.y_start_offset,
-                        (struct Cell){
-                                .ch = x < len ? E.row[y + E.row_offset]
-                                                        .chars[rx]
-                                              : ' ',
-                                ST_NORMAL,
-                        });
+            for (int x = 0; x < text_cols; x++)
+                terminal_cell_set(x + E.x_start_offset, y + E.y_start_offset,
+                                  (struct Cell){.ch = ' ', ST_NORMAL});
+
+            erow *row = &E.row[filerow];
+            window->row = filerow;
+            window->first_col =
+                    E.wrap ? sub * E.layout.cols : (size_t) E.col_offset;
+            window->start =
+                    editorRowColToByte(row, window->first_col, &window->col);
+
+            const char *chars = editorRowChars(row);
+            size_t pos = window->start;
+            size_t col = window->col;
+            while (pos < row->size && col < window->first_col + text_cols) {
+                wchar_t ch;
+                size_t n = decodeChar(&chars[pos], row->size - pos, &ch);
+                col += charWidth(ch, col);
+                pos += n;
             }
+            window->end = pos;
+
+            editorDrawWindow(y, window->start, window->end, ST_NORMAL);
 
+            if (E.wrap && ++sub < wrap_layout_lines(&E.layout, filerow))
+                continue;
+            filerow++;
+            sub = 0;
             continue;
         }
         terminal_cell_set(0, y + E.y_start_offset,
@@ -165,12 +531,79 @@ void editorDrawLines() {
     }
 }
 
+// marks rows that differ from the file on disk in the margin left of the
+// text: a bar for added and changed rows, a line where rows were removed
+void editorDrawGutter() {
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    int x = E.x_start_offset - 2;
+    if (x < 0)
+        return;
+
+    const struct DiffHunk *last =
+            E.diff.count ? &E.diff.hunks[E.diff.count - 1] : NULL;
+    for (int y = 0; y < text_rows; y++) {
+        int row = E.windows[y].row;
+        wchar_t ch = ' ';
+        uint32_t color = CL_TEXT;
+
+        const struct DiffHunk *hunk = row >= 0 ? diff_find(&E.diff, row) : NULL;
+        if (hunk && (uint32_t) row < hunk->new_start + hunk->new_count) {
+            ch = L'▎';
+            color = (uint32_t) row - hunk->new_start < hunk->old_count
+                            ? CL_CHANGED
+                            : CL_ADDED;
+        } else if (hunk && hunk->new_count == 0 &&
+                   hunk->new_start == (uint32_t) row) {
+            ch = L'▔'; // removed above this row
+            color = CL_REMOVED;
+        } else if (last && row >= 0 && row == E.num_rows - 1 &&
+                   last->new_count == 0 &&
+                   last->new_start >= (uint32_t) E.num_rows) {
+            ch = L'▁'; // removed at the end of the file
+            color = CL_REMOVED;
+        }
+
+        terminal_cell_set(x, y + E.y_start_offset,
+                          (struct Cell){
+                                  .ch = ch,
+                                  .s = STX_COLOR(color, 0),
+                          });
+    }
+}
+
+double elapsed_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - E.start_time.tv_sec) * 1e3 +
+           (now.tv_nsec - E.start_time.tv_nsec) / 1e6;
+}
+
 void debug() {
-    char buf[80];
+    char buf[160];
     int len = 0;
 
-    len += sprintf(buf, "E.cx: %d; E.cy: %d, coloff: %d, rowoff: %d        ",
-                   E.cx, E.cy, E.col_offset, E.row_offset);
+    if (E.recovery.map)
+        len = snprintf(buf, sizeof(buf),
+                       "recover %zu unsaved edits from the journal? (y/n)%-*s",
+                       E.recovery.records, E.screen_cols, "");
+    else if (E.prompt_active)
+        len = snprintf(buf, sizeof(buf), "replace (find/with): %s%-*s",
+                       E.prompt, E.screen_cols, "");
+    else if (E.status[0])
+        len = snprintf(buf, sizeof(buf), "%s%-*s", E.status, E.screen_cols,
+                       "");
+    else
+        len += sprintf(buf,
+                       "%sE.cx: %d; E.cy: %d, coloff: %d, rowoff: %d, "
+                       "first frame: %.1fms, highlighted: %.1fms        ",
+                       E.insert_mode ? "-- INSERT -- " : "", E.cx, E.cy,
+                       E.col_offset, E.row_offset, E.first_frame_ms,
+                       E.highlighted_frame_ms);
+    if (len > (int) sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    if (len > E.screen_cols)
+        len = E.screen_cols;
     for (int i = 0; i < len; i++) {
         terminal_cell_set(i, E.screen_rows,
                           (struct Cell){
@@ -180,82 +613,50 @@ void debug() {
     }
 }
 
-TSQuery *load_highlight_query() {
-    FILE *query_file = fopen(
-            "/home/silas/.config/LiteEdit/tree-sitter/c/highlights.scm", "r");
-    if (!query_file) {
-        perror("Failed to open highlights.scm");
-        die("fopen");
-    }
-
-    fseek(query_file, 0, SEEK_END);
-    long query_size = ftell(query_file);
-    fseek(query_file, 0, SEEK_SET);
-
-    char *query_string = malloc(query_size + 1);
-    if (!query_string) {
-        fclose(query_file);
-        die("malloc");
-    }
-
-    fread(query_string, 1, query_size, query_file);
-    query_string[query_size] = '\0';
-
-    fclose(query_file);
-
-    uint32_t error_offset;
-    TSQueryError error_type;
-    TSQuery *query = ts_query_new(E.language, query_string, query_size,
-                                  &error_offset, &error_type);
-
-    free(query_string);
-    if (!query) {
-        fprintf(stderr,
-                "Failed to create query: error at offset %u, error type %d\n",
-                error_offset, error_type);
-        return NULL;
-    }
+void job_start(struct backgroundJob *job, void *(*worker)(void *)) {
+    atomic_store(&job->stage, 0);
+    job->seen = 0;
+    if (pthread_create(&job->thread, NULL, worker, NULL) != 0)
+        die("pthread_create");
+    job->pending = true;
+}
 
-    return query;
+// called by the worker once a stage's results are written
+void job_advance(struct backgroundJob *job, int stage) {
+    atomic_store(&job->stage, stage);
+    terminal_wake();
 }
 
-HighlightType get_highlight_type(const char *capture_name, uint32_t len) {
-    int match_len = 0;
-    int match_index = -1;
+// returns the next stage the UI thread has not seen yet, 0 if there is none
+int job_poll(struct backgroundJob *job) {
+    int stage = atomic_load(&job->stage);
+    if (stage == job->seen)
+        return 0;
 
-    int i = 0;
-    while (tree_sitter_options[i] != NULL) {
-        const char *str = tree_sitter_options[i];
-        int this_match_len = 1;
+    return ++job->seen;
+}
 
-        int index = 0;
-        while (1) {
-            if (str[index] == '\0' || index >= len) {
-                break;
-            }
-            if (str[index] != capture_name[index]) {
-                this_match_len--;
-                break;
-            }
-            if (str[index] == '.') {
-                this_match_len++;
-            }
+void job_finish(struct backgroundJob *job) {
+    if (!job->pending)
+        return;
 
-            index++;
-        }
+    pthread_join(job->thread, NULL);
+    job->pending = false;
+}
 
-        if (this_match_len > match_len) {
-            match_len = this_match_len;
-            match_index = i;
-        }
-        i++;
-    }
+void *compile_highlight_query(void *arg) {
+    (void) arg;
 
-    if (match_index >= 0)
-        return (HighlightType) match_index + 1;
+    language_highlight_query(E.lang);
+    job_advance(&E.query_job, 1);
 
+    return NULL;
+}
 
-    return HL_NORMAL;
+// compiling the query takes longer than painting the first frame, so it runs
+// in the background and highlighting starts once it is done
+void start_highlight_query() {
+    job_start(&E.query_job, compile_highlight_query);
 }
 
 Style get_style(HighlightType type) {
@@ -303,236 +704,2155 @@ void apply_highlight(TSNode node, HighlightType hl_type) {
     TSPoint start_point = ts_node_start_point(node);
     TSPoint end_point = ts_node_end_point(node);
 
-    // Adjust start and end rows for vertical scrolling
-    int32_t start_row = start_point.row - E.row_offset;
-    int32_t end_row = end_point.row - E.row_offset;
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
 
-    // Only process visible rows
-    start_row = (start_row < 0) ? 0 : start_row;
-    end_row = (end_row >= E.screen_rows) ? E.screen_rows - 1 : end_row;
+    Style style = get_style(hl_type);
 
-    for (int32_t screen_row = start_row; screen_row <= end_row; screen_row++) {
-        int32_t file_row = screen_row + E.row_offset;
-        if (file_row >= E.num_rows)
+    // a row may cover several screen lines in wrap mode, each clips the
+    // node to its own window
+    for (int y = 0; y < text_rows; y++) {
+        int file_row = E.windows[y].row;
+        if (file_row < 0 || (uint32_t) file_row > end_point.row)
             break;
+        if ((uint32_t) file_row < start_point.row)
+            continue;
 
-        // Adjust start and end columns for horizontal scrolling
-        uint32_t col_start = (file_row == start_point.row)
-                                     ? start_point.column - E.col_offset
-                                     : 0;
-        uint32_t col_end = (file_row == end_point.row)
-                                   ? end_point.column - E.col_offset
-                                   : E.row[file_row].size - E.col_offset;
+        // point columns are byte offsets
+        size_t from = ((uint32_t) file_row == start_point.row)
+                              ? start_point.column
+                              : 0;
+        size_t to = ((uint32_t) file_row == end_point.row)
+                            ? end_point.column
+                            : E.row[file_row].size;
+        editorDrawWindow(y, from, to, style);
+    }
+}
 
-        // Ensure columns are within screen bounds
-        col_start = (col_start < 0) ? 0 : col_start;
-        col_end = (col_end > E.screen_cols) ? E.screen_cols : col_end;
+void highlightRange(TSQueryCursor *query_cursor, size_t start, size_t end) {
+    if (start >= end)
+        return;
 
-        for (uint32_t screen_col = col_start; screen_col < col_end;
-             screen_col++) {
-            uint32_t file_col = screen_col + E.col_offset;
-            if (file_col >= E.row[file_row].size)
-                break;
+    ts_query_cursor_set_byte_range(query_cursor, start, end);
+    ts_query_cursor_exec(query_cursor, E.lang->highlight_query,
+                         ts_tree_root_node(E.tree));
+
+    TSQueryMatch match;
+    while (ts_query_cursor_next_match(query_cursor, &match)) {
+        for (uint16_t i = 0; i < match.capture_count; i++) {
+            TSQueryCapture capture = match.captures[i];
+            apply_highlight(capture.node,
+                            E.lang->capture_types[capture.index]);
+        }
+    }
+}
 
-            char current_char = E.row[file_row].chars[file_col];
+// paints the highlighting saved when the file was last closed
+void editorPaintSnapshot() {
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    if (!E.snapshot.map || text_rows <= 0 || E.windows[0].row < 0)
+        return;
+
+    int last = 0;
+    while (last + 1 < text_rows && E.windows[last + 1].row >= 0)
+        last++;
+    size_t first_byte = editorRowStart(E.windows[0].row);
+    size_t end_byte = editorRowStart(E.windows[last].row) +
+                      E.row[E.windows[last].row].size;
+
+    for (uint32_t i = 0; i < E.snapshot.header->span_count; i++) {
+        const struct SnapshotSpan *span = &E.snapshot.spans[i];
+        if (span->end <= first_byte || span->start >= end_byte)
+            continue;
+
+        Style style = get_style(span->type);
+        for (int y = 0; y <= last; y++) {
+            erow *row = &E.row[E.windows[y].row];
+            size_t row_start = editorRowStart(E.windows[y].row);
+            if (span->end <= row_start)
+                break;
+            if (span->start >= row_start + row->size)
+                continue;
 
-            terminal_cell_set(screen_col, screen_row,
-                              (struct Cell){
-                                      .ch = current_char,
-                                      .s = get_style(hl_type),
-                              });
+            size_t from = span->start > row_start ? span->start - row_start : 0;
+            editorDrawWindow(y, from, span->end - row_start, style);
         }
     }
 }
 
 void editorHighlightSyntax() {
-    TSQuery *query = load_highlight_query();
-    TSQueryCursor *query_cursor = ts_query_cursor_new();
+    if (!E.tree || !E.highlighting) {
+        editorPaintSnapshot();
+        return;
+    }
 
-    TSNode root_node = ts_tree_root_node(E.tree);
+    TSQueryCursor *query_cursor = ts_query_cursor_new();
 
-    ts_query_cursor_exec(query_cursor, query, root_node);
+    // only what is on screen is highlighted. short rows are queried whole,
+    // long ones only for the bytes in their window, and adjacent ranges are
+    // queried together
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    size_t range_start = 0;
+    size_t range_end = 0;
+    bool open = false;
+    for (int y = 0; y < text_rows && E.windows[y].row >= 0; y++) {
+        struct rowWindow *window = &E.windows[y];
+        erow *row = &E.row[window->row];
+        size_t row_start = editorRowStart(window->row);
+
+        size_t start = row_start;
+        size_t end = row_start + row->size;
+        if (row->size >= CHECKPOINT_INTERVAL) {
+            start = row_start + window->start;
+            end = row_start + window->end;
+        }
 
-    TSQueryMatch match;
-    while (ts_query_cursor_next_match(query_cursor, &match)) {
-        for (uint16_t i = 0; i < match.capture_count; i++) {
-            TSQueryCapture capture = match.captures[i];
-            uint32_t len;
-            const char *capture_name = ts_query_capture_name_for_id(
-                    E.highlight_query, capture.index, &len);
-            HighlightType hl_type = get_highlight_type(capture_name, len);
-            apply_highlight(capture.node, hl_type);
+        // the gap between rows is at most a \r\n
+        if (open && start <= range_end + 2) {
+            if (end > range_end)
+                range_end = end;
+            continue;
         }
+        if (open)
+            highlightRange(query_cursor, range_start, range_end);
+        range_start = start;
+        range_end = end;
+        open = true;
     }
+    if (open)
+        highlightRange(query_cursor, range_start, range_end);
 
-    ts_query_delete(query);
     ts_query_cursor_delete(query_cursor);
 }
 
 
-void editorMoveCursor(direction dir, int value) {
-    switch (dir) {
-        case HORIZONTAL:
-            E.cx += value;
-            break;
-        case VERTICAL:
-            E.cy += value;
-            break;
-    }
+// measures every row for wrap mode. a resize only changes the line counts,
+// rows are measured again when they change
+void editorLayoutRows() {
+    wrap_layout_free(&E.layout);
+    if (!E.wrap)
+        return;
+
+    int text_cols = E.screen_cols - E.x_start_offset - E.x_end_offset;
+    if (wrap_layout_init(&E.layout, E.num_rows, text_cols) == -1)
+        die("wrap_layout_init");
+    for (int i = 0; i < E.num_rows; i++)
+        E.layout.widths[i] = editorRowByteToCol(&E.row[i], E.row[i].size);
+    wrap_layout_rebuild(&E.layout);
+
+    if (E.row_offset >= E.num_rows ||
+        E.row_sub >= wrap_layout_lines(&E.layout, E.row_offset))
+        E.row_sub = 0;
 }
 
-void editorScroll() {
-    if (E.cy < 1) {
-        E.cy = 1;
+// splits text into rows pointing into it, stopping after max_rows lines
+// unless max_rows is negative. each row is hashed too if hashes is not NULL
+int editorIndexRows(char *text, size_t len, int max_rows, erow **rows,
+                    uint64_t **hashes) {
+    int num_rows = 0;
+    int cap = 0;
+    size_t pos = 0;
+
+    *rows = NULL;
+    if (hashes)
+        *hashes = NULL;
+    while (pos < len && (max_rows < 0 || num_rows < max_rows)) {
+        char *line = &text[pos];
+        char *newline = memchr(line, '\n', len - pos);
+        size_t linelen = newline ? (size_t) (newline - line) : len - pos;
+        pos += linelen + (newline ? 1 : 0);
+        // the hash sees a carriage return, so it tells every change apart
+        uint64_t hash = hashes ? diff_hash_line(line, linelen) : 0;
+
+        while (linelen > 0 &&
+               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            linelen--;
+
+        if (num_rows == cap) {
+            cap = cap ? cap * 2 : 64;
+            erow *grown = mem_realloc(MEM_ROWS, *rows, sizeof(erow) * cap);
+            if (!grown)
+                die("realloc");
+            *rows = grown;
+
+            if (hashes) {
+                uint64_t *grown_hashes = mem_realloc(MEM_INDEX, *hashes,
+                                                     sizeof(uint64_t) * cap);
+                if (!grown_hashes)
+                    die("realloc");
+                *hashes = grown_hashes;
+            }
+        }
+        (*rows)[num_rows].size = linelen;
+        (*rows)[num_rows].start = line - text;
+        (*rows)[num_rows].checkpoints = NULL;
+        if (hashes)
+            (*hashes)[num_rows] = hash;
+        num_rows++;
     }
-    if (E.cy > E.num_rows) {
-        E.cy = E.num_rows;
+
+    return num_rows;
+}
+
+// a journal with records holds edits that were never saved, it is offered
+// for replay before anything else happens, see editorRecoverKey()
+void editorOpenJournal(const struct stat *st) {
+    char path[sizeof(E.journal.path)];
+    if (journal_path(E.filename, path, sizeof(path)) == -1)
+        return;
+
+    struct JournalHeader header = journal_header(st->st_size, st->st_mtim);
+    if (journal_read_open(&E.recovery, path) == 0) {
+        if (E.recovery.records > 0 &&
+            journal_header_matches(E.recovery.header, &header))
+            return;
+
+        // its edits are for a version of the file that is gone
+        if (E.recovery.records > 0) {
+            char old_path[sizeof(path) + 4];
+            snprintf(old_path, sizeof(old_path), "%s.old", path);
+            if (rename(path, old_path) == 0)
+                snprintf(E.status, sizeof(E.status),
+                         "file changed on disk, journal moved to .old");
+        }
+        journal_read_close(&E.recovery);
     }
-    if (E.cy - E.row_offset > E.screen_rows) {
-        E.row_offset += E.cy - E.row_offset - E.screen_rows;
+
+    if (journal_start(&E.journal, path, &header, NULL) == -1)
+        snprintf(E.status, sizeof(E.status), "journal: %s", strerror(errno));
+}
+
+// the highlighting saved when the file was last closed is painted until the
+// parse is done, as long as the file has not changed since
+void editorOpenSnapshot(const struct stat *st) {
+    char path[4096];
+    if (snapshot_cache_path(E.filename, path, sizeof(path)) == 0)
+        snapshot_open(&E.snapshot, path, st->st_size, st->st_mtim, E.text,
+                      E.len_text);
+}
+
+// saves the highlighting of the file's first rows for the next open
+void editorSaveSnapshot() {
+    if (!E.tree || !E.highlighting)
+        return;
+    // the spans are the buffer's, they only hold for the file while it was
+    // not edited and the tree is not waiting on a reparse
+    if (E.undo.count > 0 || E.diff.count > 0 || E.reparse_job.pending ||
+        E.tree_edit_count > 0)
+        return;
+
+    char path[4096];
+    struct stat st;
+    if (snapshot_cache_path(E.filename, path, sizeof(path)) == -1 ||
+        stat(E.filename, &st) == -1 || st.st_size != E.len_text)
+        return;
+
+    size_t covered =
+            editorRowStart(E.num_rows < SNAPSHOT_ROWS ? E.num_rows
+                                                      : SNAPSHOT_ROWS);
+    if (covered > SNAPSHOT_BYTES)
+        covered = SNAPSHOT_BYTES;
+
+    struct SnapshotSpan *spans = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    TSQueryCursor *query_cursor = ts_query_cursor_new();
+    ts_query_cursor_set_byte_range(query_cursor, 0, covered);
+    ts_query_cursor_exec(query_cursor, E.lang->highlight_query,
+                         ts_tree_root_node(E.tree));
+
+    TSQueryMatch match;
+    while (ts_query_cursor_next_match(query_cursor, &match)) {
+        for (uint16_t i = 0; i < match.capture_count; i++) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 256;
+                spans = mem_realloc(MEM_HIGHLIGHT, spans,
+                                    sizeof(struct SnapshotSpan) * cap);
+                if (!spans)
+                    die("realloc");
+            }
+            TSQueryCapture capture = match.captures[i];
+            uint32_t end = ts_node_end_byte(capture.node);
+            spans[count++] = (struct SnapshotSpan){
+                    .start = ts_node_start_byte(capture.node),
+                    .end = end < covered ? end : covered,
+                    .type = E.lang->capture_types[capture.index],
+            };
+        }
     }
-    if (E.cy - E.row_offset < 1) {
-        E.row_offset += E.cy - E.row_offset - 1;
+    ts_query_cursor_delete(query_cursor);
+
+    struct SnapshotHeader header = {
+            .span_count = count,
+            .size = st.st_size,
+            .mtime_sec = st.st_mtim.tv_sec,
+            .mtime_nsec = st.st_mtim.tv_nsec,
+            .covered = covered,
+            .hash = util_hash(UTIL_HASH_SEED, E.text, covered),
+    };
+    snapshot_write(path, &header, spans);
+    mem_free(spans);
+}
+
+// maps the file and indexes only what is needed to paint the screen starting
+// at first_row, the rest is read and indexed by the load job. the mapping is
+// only painted, it is never edited
+void editorOpen(const char *filename, int first_row) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        die("open");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        die("fstat");
+
+    E.filename = strdup(filename);
+    if (!E.filename)
+        die("strdup");
+    E.file_dev = st.st_dev;
+    E.file_ino = st.st_ino;
+
+    E.len_text = st.st_size;
+    E.text = NULL;
+    if (E.len_text > 0) {
+        E.text = mmap(NULL, E.len_text, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (E.text == MAP_FAILED)
+            die("mmap");
+        mem_account(MEM_TEXT, E.len_text);
     }
+    E.load_fd = fd;
+    E.text_cap = E.len_text;
+    E.text_mapped = E.text != NULL;
+    editorOpenJournal(&st);
+    editorOpenSnapshot(&st);
+
+    E.num_rows = editorIndexRows(E.text, E.len_text, first_row + E.screen_rows,
+                                 &E.row, NULL);
+    editorLayoutRows();
 }
 
-void editorRefreshScreen() {
-    editorScroll();
-    terminal_move_cursor(E.cx - E.col_offset, E.cy - E.row_offset);
-    debug();
-    editorDrawLines();
-    // editorHighlightSyntax();
-    terminal_refresh();
-    E.needs_redraw = false;
+// reads the text rather than copying the mapping, so a file truncated or
+// rewritten behind the editor cannot fault the buffer. it is swapped in at
+// LOAD_ROWS, before anything can be edited
+void *load_file(void *arg) {
+    (void) arg;
+
+    size_t size = E.len_text;
+    E.loaded_cap = size + size / 2 + 4096;
+    E.loaded_text = mem_malloc(MEM_TEXT, E.loaded_cap);
+    if (!E.loaded_text)
+        die("malloc");
+    E.loaded_len = 0;
+    while (E.loaded_len < size) {
+        ssize_t n = pread(E.load_fd, E.loaded_text + E.loaded_len,
+                          size - E.loaded_len, E.loaded_len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // the file shrank, the rest is gone
+        E.loaded_len += n;
+    }
+    close(E.load_fd);
+    E.load_fd = -1;
+
+    E.loaded_num_rows = editorIndexRows(E.loaded_text, E.loaded_len, -1,
+                                        &E.loaded_row, &E.loaded_hashes);
+    job_advance(&E.load_job, LOAD_ROWS);
+
+    const TSLanguage *grammar = E.lang ? language_grammar(E.lang) : NULL;
+    E.loaded_parser = ts_parser_new();
+    if (grammar && ts_parser_set_language(E.loaded_parser, grammar))
+        E.loaded_tree = ts_parser_parse_string(E.loaded_parser, NULL,
+                                               E.loaded_text, E.loaded_len);
+    job_advance(&E.load_job, LOAD_TREE);
+
+    return NULL;
 }
 
-void editorReadEvent() {
-    int c = terminal_read_input();
+// grammar setup, query compilation and the full parse all happen off the
+// UI thread, highlighting appears once both jobs are done
+void init_tree_sitter(const char *filename) {
+    E.lang = language_detect(filename, E.text, E.len_text);
+    if (E.lang)
+        start_highlight_query();
 
-    switch (c) {
-        case 'q':
-            exit(0);
-        case 'h':
-            editorMoveCursor(HORIZONTAL, -1);
-            break;
-        case 'j':
-            editorMoveCursor(VERTICAL, 1);
-            break;
-        case 'k':
-            editorMoveCursor(VERTICAL, -1);
-            break;
-        case 'l':
-            editorMoveCursor(HORIZONTAL, 1);
-            break;
-        case ctrl('u'):
-            editorMoveCursor(VERTICAL, -34);
-            break;
-        case ctrl('d'):
-            editorMoveCursor(VERTICAL, 34);
-            break;
+    job_start(&E.load_job, load_file);
+}
+
+// hashes the rows of the file on disk, unless it is unchanged since the
+// last diff. fails if the file cannot be read
+int load_base_hashes() {
+    struct stat st;
+    if (stat(E.filename, &st) == -1) {
+        mem_free(E.base_hashes);
+        E.base_hashes = NULL;
+        E.base_count = 0;
+        return -1;
     }
+    if (E.base_hashes && st.st_size == E.base_size &&
+        st.st_mtim.tv_sec == E.base_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == E.base_mtime.tv_nsec)
+        return 0;
+
+    mem_free(E.base_hashes);
+    E.base_hashes = NULL;
+    E.base_count = 0;
+    E.base_size = st.st_size;
+    E.base_mtime = st.st_mtim;
+    E.base_newline = false;
+
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    char *text = NULL;
+    if (st.st_size > 0)
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+        return -1;
+
+    E.base_newline = text && text[st.st_size - 1] == '\n';
+    erow *rows;
+    E.base_count =
+            editorIndexRows(text, st.st_size, -1, &rows, &E.base_hashes);
+    mem_free(rows);
+    if (text)
+        munmap(text, st.st_size);
+
+    return 0;
 }
 
+void *diff_file(void *arg) {
+    (void) arg;
+
+    E.diff_complete = load_base_hashes() == 0;
+    if (diff_lines(&E.loaded_diff, E.base_hashes, E.base_count,
+                   E.diff_hashes, E.diff_count) == -1) {
+        E.loaded_diff.count = 0;
+        E.diff_complete = false;
+    }
+    job_advance(&E.diff_job, 1);
 
-void editorAppenRow(char *line, size_t len) {
-    E.row = realloc(E.row, sizeof(erow) * (E.num_rows + 1));
+    return NULL;
+}
 
-    int index = E.num_rows;
-    E.row[index].size = len;
-    E.row[index].chars = malloc(len + 1);
+// diffs a snapshot of the row hashes against the file on disk. the UI never
+// waits for it: a change while a diff runs schedules another one for when
+// it is done. only the rows edited since the last snapshot are copied
+void editorScheduleDiff() {
+    if (!E.hashes)
+        return;
+    if (E.diff_job.pending) {
+        E.diff_dirty = true;
+        return;
+    }
 
-    strncpy(E.row[index].chars, line, len);
-    E.num_rows++;
+    E.diff_dirty = false;
+    size_t count = E.num_rows;
+    if (!E.diff_hashes)
+        E.diff_count = E.diff_from = E.diff_tail = 0;
+    size_t kept = count < E.diff_count ? count : E.diff_count;
+    size_t from = E.diff_from < kept ? E.diff_from : kept;
+    size_t tail = E.diff_tail < kept - from ? E.diff_tail : kept - from;
+
+    if (count + 1 > E.diff_cap) {
+        size_t cap = count + count / 2 + 64;
+        uint64_t *snapshot = mem_realloc(MEM_DIFF, E.diff_hashes,
+                                         sizeof(uint64_t) * cap);
+        if (!snapshot)
+            die("realloc");
+        E.diff_hashes = snapshot;
+        E.diff_cap = cap;
+    }
+    if (count != E.diff_count)
+        memmove(E.diff_hashes + count - tail,
+                E.diff_hashes + E.diff_count - tail, sizeof(uint64_t) * tail);
+    memcpy(E.diff_hashes + from, E.hashes + from,
+           sizeof(uint64_t) * (count - tail - from));
+    E.diff_count = count;
+    E.diff_from = E.diff_tail = count;
+
+    job_start(&E.diff_job, diff_file);
 }
 
-void editorOpen(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
-        die("fopen");
+// the diff only compared row hashes. the rows edits leave alone must match
+// the file the diff ran on byte for byte, or a rows record would drop an
+// edited row whose hash collided
+bool editorJournalRowsMatch(const struct JournalEdit *edits, size_t count) {
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != E.base_size ||
+        st.st_mtim.tv_sec != E.base_mtime.tv_sec ||
+        st.st_mtim.tv_nsec != E.base_mtime.tv_nsec) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    char *file = NULL;
+    if (size > 0)
+        file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return false;
+
+    bool match = true;
+    size_t pos = 0;
+    uint64_t old_row = 0;
+    uint64_t new_row = 0;
+    for (size_t k = 0; match && k <= count; k++) {
+        uint64_t old_end = k < count ? edits[k].start : E.base_count;
+        uint64_t new_end = k < count ? edits[k].text : (uint64_t) E.num_rows;
+        size_t from = editorRowStart(new_row);
+        size_t to = editorRowStart(new_end);
+        if (old_end - old_row != new_end - new_row || to - from > size - pos ||
+            memcmp(file + pos, E.text + from, to - from) != 0) {
+            match = false;
+            break;
+        }
+        pos += to - from;
+        if (k == count)
+            break;
+
+        for (uint64_t i = edits[k].start; i < edits[k].end && pos < size; i++) {
+            const char *newline = memchr(file + pos, '\n', size - pos);
+            pos = newline ? (size_t) (newline - file) + 1 : size;
+        }
+        old_row = edits[k].end;
+        new_row = edits[k].len;
+    }
+    if (file)
+        munmap(file, size);
 
-    // load file into E.text
-    long length;
-    fseek(fp, 0L, SEEK_END);
-    length = ftell(fp);
-    rewind(fp);
+    return match && pos == size;
+}
 
-    E.text = (char *) malloc((length + 1) + sizeof(char));
-    if (!E.text) {
+// once min_size bytes were journaled, the journal is rewritten as the rows
+// that differ from the file on disk, which the diff that just landed lists.
+// it is only worth it while those rows are smaller than what it replaces,
+// and once the rows the diff kept are confirmed to match the file
+void editorCompactJournal(size_t min_size) {
+    if (!E.journal.started || E.journal.size < min_size ||
+        !E.diff_complete || E.diff_count != (size_t) E.num_rows)
+        return;
+
+    struct JournalEdit *edits = mem_malloc(
+            MEM_JOURNAL, sizeof(struct JournalEdit) * (E.diff.count + 1));
+    if (!edits)
         die("malloc");
+
+    // rows of the file on disk, replaced by rows of the text
+    size_t count = 0;
+    for (size_t i = 0; i < E.diff.count; i++) {
+        const struct DiffHunk *hunk = &E.diff.hunks[i];
+        edits[count++] = (struct JournalEdit){
+                .start = hunk->old_start,
+                .end = hunk->old_start + hunk->old_count,
+                .text = hunk->new_start,
+                .len = hunk->new_start + hunk->new_count,
+        };
     }
 
-    fread(E.text, sizeof(char), length, fp);
-    E.len_text = length;
+    // the row hashes do not see the newline at the end of the text
+    bool newline = E.len_text > 0 && E.text[E.len_text - 1] == '\n';
+    if (newline != E.base_newline) {
+        uint64_t old_last = E.base_count ? E.base_count - 1 : 0;
+        uint64_t new_last = E.num_rows ? E.num_rows - 1 : 0;
+        if (count == 0 || (edits[count - 1].end < old_last &&
+                           edits[count - 1].len < new_last))
+            edits[count++] = (struct JournalEdit){
+                    .start = old_last,
+                    .text = new_last,
+            };
+        edits[count - 1].end = E.base_count;
+        edits[count - 1].len = E.num_rows;
+    }
 
-    fp = fopen(filename, "r");
-    if (!fp)
-        die("fopen");
-    ssize_t linelen;
-    size_t len = 0;
-    char *line = NULL;
+    size_t text_len = 0;
+    for (size_t i = 0; i < count; i++)
+        text_len +=
+                editorRowStart(edits[i].len) - editorRowStart(edits[i].text);
+    if (text_len >= E.journal.size / 2 ||
+        !editorJournalRowsMatch(edits, count)) {
+        mem_free(edits);
+        return;
+    }
 
-    while ((linelen = getline(&line, &len, fp)) != -1) {
-        while (linelen > 0 &&
-               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-            linelen--;
-        editorAppenRow(line, linelen);
+    for (size_t i = 0; i < count; i++) {
+        size_t from = editorRowStart(edits[i].text);
+        edits[i].len = editorRowStart(edits[i].len) - from;
+        edits[i].text = from;
     }
 
-    free(line);
-    fclose(fp);
+    struct JournalHeader header = journal_header(E.base_size, E.base_mtime);
+    if (journal_compact(&E.journal, &header, JOURNAL_ROWS, edits, count,
+                        E.text) == -1)
+        snprintf(E.status, sizeof(E.status), "journal: %s", strerror(errno));
+    mem_free(edits);
 }
 
+void *reparse(void *arg) {
+    (void) arg;
 
-void init_tree_sitter() {
-    E.parser = ts_parser_new();
+    E.reparsed_tree = ts_parser_parse_string(E.parser, E.reparse_old,
+                                             E.reparse_text, E.reparse_len);
+    job_advance(&E.reparse_job, 1);
 
-    E.language = tree_sitter_c();
+    return NULL;
+}
 
-    if (!ts_parser_set_language(E.parser, E.language))
-        die("ts_parser_set_language");
+// reparses the edited tree. small edits finish within PARSE_BUDGET_US, the
+// rest continue in the background on a copy of the text while the edited
+// tree keeps being shown
+void update_syntax_tree() {
+    if (!E.tree || !E.parser || E.reparse_job.pending)
+        return;
+
+    ts_parser_set_timeout_micros(E.parser, PARSE_BUDGET_US);
+    TSTree *tree = ts_parser_parse_string(E.parser, E.tree, E.text, E.len_text);
+    if (tree) {
+        ts_tree_delete(E.tree);
+        E.tree = tree;
+        return;
+    }
 
-    E.highlight_query = load_highlight_query();
+    ts_parser_reset(E.parser);
+    ts_parser_set_timeout_micros(E.parser, 0);
+    E.reparse_len = E.len_text;
+    E.reparse_text = mem_malloc(MEM_TEXT, E.reparse_len + 1);
+    if (!E.reparse_text)
+        die("malloc");
+    memcpy(E.reparse_text, E.text, E.reparse_len);
+    E.reparse_old = ts_tree_copy(E.tree);
+    job_start(&E.reparse_job, reparse);
 }
 
-void update_syntax_tree() {
-    E.tree = ts_parser_parse_string(E.parser, E.tree, E.text, E.len_text);
+// the tree the job returns is for the text it copied, edits made since are
+// replayed on it and reparsed in turn
+void editorFinishReparse() {
+    job_finish(&E.reparse_job);
+    mem_free(E.reparse_text);
+    ts_tree_delete(E.reparse_old);
+    E.reparse_text = NULL;
+    E.reparse_old = NULL;
+
+    if (E.reparsed_tree) {
+        for (size_t i = 0; i < E.tree_edit_count; i++)
+            ts_tree_edit(E.reparsed_tree, &E.tree_edits[i]);
+        ts_tree_delete(E.tree);
+        E.tree = E.reparsed_tree;
+        E.reparsed_tree = NULL;
+    }
+
+    bool edited = E.tree_edit_count > 0;
+    E.tree_edit_count = 0;
+    if (edited)
+        update_syntax_tree();
 }
 
+void editorTransactionReplace(struct editorTransaction *t, size_t start,
+                              size_t end, const char *text, size_t len) {
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 16;
+        t->edits = mem_realloc(MEM_UNDO, t->edits,
+                               sizeof(struct editorEdit) * t->cap);
+        if (!t->edits)
+            die("realloc");
+    }
+    if (t->arena_len + len > t->arena_cap || !t->arena) {
+        while (t->arena_len + len > t->arena_cap)
+            t->arena_cap = t->arena_cap ? t->arena_cap * 2 : 256;
+        t->arena = mem_realloc(MEM_UNDO, t->arena, t->arena_cap);
+        if (!t->arena)
+            die("realloc");
+    }
 
-void initEditor() {
-    terminal_get_size(&E.screen_cols, &E.screen_rows);
-    E.cx = 1;
-    E.cy = 1;
+    if (len > 0)
+        memcpy(&t->arena[t->arena_len], text, len);
+    t->edits[t->count] = (struct editorEdit){
+            .start = start,
+            .end = end,
+            .text = t->arena_len,
+            .len = len,
+            .order = t->count,
+    };
+    t->count++;
+    t->arena_len += len;
+}
 
-    E.x_start_offset = 5;
-    E.x_end_offset = 5;
-    E.y_start_offset = 5;
-    E.y_end_offset = 5;
+void editorTransactionFree(struct editorTransaction *t) {
+    mem_free(t->edits);
+    mem_free(t->arena);
+    *t = (struct editorTransaction){0};
+}
 
-    E.num_rows = 0;
-    E.row_offset = 0;
-    E.col_offset = 0;
-    E.needs_redraw = true;
+void undoStackClear(struct undoStack *stack) {
+    for (size_t i = 0; i < stack->count; i++)
+        editorTransactionFree(&stack->entries[i]);
+    stack->count = 0;
+}
 
-    E.screen_rows -= 1;
+void undoStackPush(struct undoStack *stack, struct editorTransaction *t) {
+    if (stack->count == stack->cap) {
+        stack->cap = stack->cap ? stack->cap * 2 : 64;
+        stack->entries =
+                mem_realloc(MEM_UNDO, stack->entries,
+                            sizeof(struct editorTransaction) * stack->cap);
+        if (!stack->entries)
+            die("realloc");
+    }
+    stack->entries[stack->count++] = *t;
+}
 
-    E.row = NULL;
+// frees the oldest count entries, the ones furthest from the text
+void undoStackTrim(struct undoStack *stack, size_t count) {
+    if (count > stack->count)
+        count = stack->count;
+    for (size_t i = 0; i < count; i++)
+        editorTransactionFree(&stack->entries[i]);
+    memmove(stack->entries, stack->entries + count,
+            sizeof(struct editorTransaction) * (stack->count - count));
+    stack->count -= count;
 }
 
+void *walk_files(void *arg) {
+    (void) arg;
+
+    file_list_walk(&E.loaded_files, ".");
+    job_advance(&E.walk_job, 1);
+
+    return NULL;
+}
+
+// how many matches the picker lists, one row is its prompt
+size_t editorPickerRows() {
+    int rows = E.screen_rows - E.y_start_offset - E.y_end_offset - 1;
+    return rows > 1 ? rows : 1;
+}
+
+void editorPickerSearch() {
+    if (!E.finder.files)
+        return;
+
+    double start = elapsed_ms();
+    finder_set_query(&E.finder, E.picker_query, E.picker_query_len);
+    E.picker_ms = elapsed_ms() - start;
+
+    if (E.picker_selected >= (int) E.finder.top_count)
+        E.picker_selected = E.finder.top_count ? E.finder.top_count - 1 : 0;
+}
+
+void editorPollJobs() {
+    if (job_poll(&E.query_job)) {
+        job_finish(&E.query_job);
+        E.highlighting = E.lang->highlight_query != NULL;
+        E.needs_redraw = true;
+    }
+
+    int stage;
+    while ((stage = job_poll(&E.load_job))) {
+        switch (stage) {
+            case LOAD_ROWS:
+                if (E.text_mapped) {
+                    munmap(E.text, E.text_cap);
+                    mem_account(MEM_TEXT, -(int64_t) E.text_cap);
+                } else
+                    mem_free(E.text);
+                E.text = E.loaded_text;
+                E.len_text = E.loaded_len;
+                E.text_cap = E.loaded_cap;
+                E.text_mapped = false;
+                E.loaded_text = NULL;
+                editorFreeRows(E.row, E.num_rows);
+                E.row = E.loaded_row;
+                E.num_rows = E.loaded_num_rows;
+                E.hashes = E.loaded_hashes;
+                E.shift_row = 0;
+                E.shift_delta = 0;
+                E.diff_from = E.diff_tail = 0;
+                editorLayoutRows();
+                editorScheduleDiff();
+                break;
+            case LOAD_TREE:
+                job_finish(&E.load_job);
+                E.parser = E.loaded_parser;
+                E.tree = E.loaded_tree;
+                break;
+        }
+        E.needs_redraw = true;
+    }
+    if (E.snapshot.map && E.tree && E.highlighting)
+        snapshot_close(&E.snapshot);
+
+    if (job_poll(&E.diff_job)) {
+        job_finish(&E.diff_job);
+        // the shown hunks' memory is reused by the next diff
+        struct Diff shown = E.diff;
+        E.diff = E.loaded_diff;
+        E.loaded_diff = shown;
+        E.needs_redraw = true;
+        if (E.diff_dirty)
+            editorScheduleDiff();
+        else
+            editorCompactJournal(JOURNAL_COMPACT_SIZE);
+    }
+
+    if (job_poll(&E.reparse_job)) {
+        editorFinishReparse();
+        E.needs_redraw = true;
+    }
+
+    if (job_poll(&E.index_job)) {
+        job_finish(&E.index_job);
+        // a failed update keeps the index that is mapped
+        if (E.loaded_symbols.map) {
+            symbol_index_close(&E.symbols);
+            E.symbols = E.loaded_symbols;
+        }
+        E.loaded_symbols = (struct SymbolIndex){0};
+    }
+
+    if (job_poll(&E.walk_job)) {
+        job_finish(&E.walk_job);
+        finder_free(&E.finder);
+        file_list_free(&E.files);
+        E.files = E.loaded_files;
+        if (finder_init(&E.finder, &E.files, editorPickerRows()) == 0)
+            editorPickerSearch();
+        E.needs_redraw = true;
+    }
+}
+
+// the journal stays for edits that could be recovered, and goes once the
+// buffer matches the file on disk again
+void editorCloseJournal() {
+    if (!E.diff_job.pending && !E.diff_dirty)
+        editorCompactJournal(0);
+    journal_read_close(&E.recovery);
+    journal_close(&E.journal, E.journal.records == 0);
+}
+
+// waits for the buffer's jobs and releases everything it owns
+void editorClose() {
+    job_finish(&E.query_job);
+    job_finish(&E.load_job);
+    editorPollJobs();
+    if (E.load_fd != -1) {
+        close(E.load_fd);
+        E.load_fd = -1;
+    }
+    editorSaveSnapshot();
+    snapshot_close(&E.snapshot);
+    editorCloseJournal();
+    job_finish(&E.diff_job);
+    job_poll(&E.diff_job); // the result is for this file
+    if (E.reparse_job.pending) {
+        job_finish(&E.reparse_job);
+        job_poll(&E.reparse_job);
+        mem_free(E.reparse_text);
+        ts_tree_delete(E.reparse_old);
+        ts_tree_delete(E.reparsed_tree);
+        E.reparse_text = NULL;
+        E.reparse_old = NULL;
+        E.reparsed_tree = NULL;
+        E.tree_edit_count = 0;
+    }
+    undoStackClear(&E.undo);
+    undoStackClear(&E.redo);
+
+    editorFreeRows(E.row, E.num_rows);
+    mem_free(E.hashes);
+    mem_free(E.diff_hashes);
+    mem_free(E.base_hashes);
+    diff_free(&E.diff);
+    diff_free(&E.loaded_diff);
+    if (E.text_mapped) {
+        munmap(E.text, E.text_cap);
+        mem_account(MEM_TEXT, -(int64_t) E.text_cap);
+    } else
+        mem_free(E.text);
+    ts_tree_delete(E.tree);
+    if (E.parser)
+        ts_parser_delete(E.parser);
+    mem_free(E.tree_edits);
+    free(E.filename);
+
+    E.row = NULL;
+    E.num_rows = 0;
+    E.hashes = NULL;
+    E.diff_hashes = NULL;
+    E.diff_count = 0;
+    E.diff_cap = 0;
+    E.base_hashes = NULL;
+    E.base_count = 0;
+    E.shift_row = 0;
+    E.shift_delta = 0;
+    E.diff_dirty = false;
+    E.text = NULL;
+    E.len_text = 0;
+    E.text_cap = 0;
+    E.text_mapped = false;
+    E.insert_mode = false;
+    E.tree = NULL;
+    E.parser = NULL;
+    E.tree_edits = NULL;
+    E.tree_edit_cap = 0;
+    E.filename = NULL;
+    E.lang = NULL;
+    E.highlighting = false;
+    E.cx = 1;
+    E.cy = 1;
+    E.row_offset = 0;
+    E.col_offset = 0;
+    E.row_sub = 0;
+    wrap_layout_free(&E.layout);
+}
+
+int compare_edits(const void *a, const void *b) {
+    const struct editorEdit *x = a;
+    const struct editorEdit *y = b;
+
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    if (x->end != y->end)
+        return x->end < y->end ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// the row byte falls in
+int editorRowAt(size_t byte) {
+    int lo = 0;
+    int hi = E.num_rows;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (editorRowStart(mid) <= byte)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+TSPoint editorPointAt(size_t byte) {
+    if (E.num_rows == 0)
+        return (TSPoint){0, byte};
+
+    // the text may end with a newline that starts no row
+    if (byte == (size_t) E.len_text && E.text[byte - 1] == '\n')
+        return (TSPoint){E.num_rows, 0};
+
+    int row = editorRowAt(byte);
+    return (TSPoint){row, byte - editorRowStart(row)};
+}
+
+size_t editorCursorByte() {
+    int file_row = E.cy - 1;
+    if (file_row < 0 || file_row >= E.num_rows)
+        return file_row < 0 ? 0 : E.len_text;
+
+    size_t col;
+    return editorRowStart(file_row) +
+           editorRowColToByte(&E.row[file_row], E.cx - 1, &col);
+}
+
+void editorSetCursorByte(size_t byte) {
+    if (E.num_rows == 0) {
+        E.cx = 1;
+        E.cy = 1;
+        return;
+    }
+
+    int row = editorRowAt(byte);
+    E.cy = row + 1;
+    E.cx = editorRowByteToCol(&E.row[row], byte - editorRowStart(row)) + 1;
+}
+
+// queues t for the journal's writer thread, which does the I/O
+void editorJournalEdits(const struct editorTransaction *t) {
+    if (!E.journal.started)
+        return;
+
+    struct JournalEdit *edits =
+            mem_malloc(MEM_JOURNAL, sizeof(struct JournalEdit) * t->count);
+    if (!edits)
+        die("malloc");
+    for (size_t i = 0; i < t->count; i++) {
+        edits[i] = (struct JournalEdit){
+                .start = t->edits[i].start,
+                .end = t->edits[i].end,
+                .text = t->edits[i].text,
+                .len = t->edits[i].len,
+        };
+    }
+    if (journal_append(&E.journal, JOURNAL_EDITS, edits, t->count,
+                       t->arena) == -1)
+        snprintf(E.status, sizeof(E.status), "journal: %s", strerror(errno));
+    mem_free(edits);
+}
+
+// moves the text between edits to where it ends up after them. what moves
+// right is moved last-first and what moves left first-last, so nothing is
+// overwritten before it has moved
+void editorMoveSegments(char *text, const struct editorEdit *edits,
+                        size_t count, const int64_t *shifts) {
+    for (size_t k = count + 1; k-- > 0;) {
+        size_t from = k > 0 ? edits[k - 1].end : 0;
+        size_t to = k < count ? edits[k].start : (size_t) E.len_text;
+        if (shifts[k] > 0)
+            memmove(text + from + shifts[k], text + from, to - from);
+    }
+    for (size_t k = 0; k <= count; k++) {
+        size_t from = k > 0 ? edits[k - 1].end : 0;
+        size_t to = k < count ? edits[k].start : (size_t) E.len_text;
+        if (shifts[k] < 0)
+            memmove(text + from + shifts[k], text + from, to - from);
+    }
+}
+
+// moves the boundary of the pending shift to row, bringing the rows in
+// between up to date. an edit near the last one only touches the rows
+// between the two
+void editorShiftRows(int row) {
+    if (E.shift_delta == 0) {
+        E.shift_row = row;
+        return;
+    }
+
+    for (; E.shift_row < row; E.shift_row++)
+        E.row[E.shift_row].start += E.shift_delta;
+    for (; E.shift_row > row; E.shift_row--)
+        E.row[E.shift_row - 1].start -= E.shift_delta;
+}
+
+// applies t in one pass over the text. rows outside the edited regions are
+// only moved, so their hashes, widths and column checkpoints are kept.
+// inverse receives the edits that undo t
+int editorApply(struct editorTransaction *t,
+                struct editorTransaction *inverse) {
+    // the rows and the tree are only complete once the load job is done
+    if (E.load_job.pending) {
+        job_finish(&E.load_job);
+        editorPollJobs();
+    }
+
+    struct editorEdit *edits = t->edits;
+    size_t count = t->count;
+    size_t len = E.len_text;
+    if (count == 0)
+        return 0;
+
+    for (size_t i = 1; i < count; i++) {
+        if (compare_edits(&edits[i - 1], &edits[i]) > 0) {
+            qsort(edits, count, sizeof(*edits), compare_edits);
+            break;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].start > edits[i].end || edits[i].end > len ||
+            (i > 0 && edits[i].start < edits[i - 1].end)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    // shifts[k] is how far the text before edit k moves
+    int64_t *shifts = mem_malloc(MEM_UNDO, sizeof(int64_t) * (count + 1));
+    struct editRegion *regions =
+            mem_malloc(MEM_UNDO, sizeof(struct editRegion) * count);
+    if (!shifts || !regions)
+        die("malloc");
+
+    size_t region_count = 0;
+    shifts[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        int64_t delta = (int64_t) edits[i].len -
+                        (int64_t) (edits[i].end - edits[i].start);
+        shifts[i + 1] = shifts[i] + delta;
+
+        editorTransactionReplace(inverse, edits[i].start + shifts[i],
+                                 edits[i].start + shifts[i] + edits[i].len,
+                                 E.text + edits[i].start,
+                                 edits[i].end - edits[i].start);
+
+        int first = E.num_rows ? editorRowAt(edits[i].start) : 0;
+        int last = E.num_rows ? editorRowAt(edits[i].end) + 1 : 0;
+        struct editRegion *prev =
+                region_count ? &regions[region_count - 1] : NULL;
+        if (prev && first < prev->last_row) {
+            if (last > prev->last_row)
+                prev->last_row = last;
+            prev->last_edit = i + 1;
+            prev->delta += delta;
+            continue;
+        }
+        regions[region_count++] = (struct editRegion){
+                .first_row = first,
+                .last_row = last,
+                .first_edit = i,
+                .last_edit = i + 1,
+                .delta = delta,
+        };
+    }
+    for (size_t k = 0; k < region_count; k++) {
+        regions[k].start = editorRowStart(regions[k].first_row);
+        regions[k].end = editorRowStart(regions[k].last_row);
+    }
+
+    // tree-sitter gets one edit per region, or a single one spanning them
+    // all when there are too many to be worth telling apart
+    size_t tree_count = region_count <= MAX_TREE_EDITS ? region_count : 1;
+    TSInputEdit *tree_edits =
+            mem_malloc(MEM_TREE, sizeof(TSInputEdit) * tree_count);
+    if (!tree_edits)
+        die("malloc");
+    for (size_t k = 0; k < tree_count; k++) {
+        size_t first = tree_count == 1 ? 0 : regions[k].first_edit;
+        size_t last = tree_count == 1 ? count : regions[k].last_edit;
+        tree_edits[k] = (TSInputEdit){
+                .start_byte = edits[first].start,
+                .old_end_byte = edits[last - 1].end,
+                .new_end_byte = edits[last - 1].end + shifts[last] -
+                                shifts[first],
+                .start_point = editorPointAt(edits[first].start),
+                .old_end_point = editorPointAt(edits[last - 1].end),
+        };
+    }
+
+    size_t new_len = len + shifts[count];
+    char *text = E.text;
+    size_t cap = E.text_cap;
+    if (new_len > cap || !text || E.text_mapped) {
+        cap = new_len + new_len / 2 + 4096;
+        text = mem_malloc(MEM_TEXT, cap);
+        if (!text)
+            die("malloc");
+
+        size_t out = 0;
+        for (size_t k = 0; k <= count; k++) {
+            size_t from = k > 0 ? edits[k - 1].end : 0;
+            size_t to = k < count ? edits[k].start : len;
+            if (to > from)
+                memcpy(text + out, E.text + from, to - from);
+            out += to - from;
+            if (k < count) {
+                memcpy(text + out, t->arena + edits[k].text, edits[k].len);
+                out += edits[k].len;
+            }
+        }
+    } else {
+        editorMoveSegments(text, edits, count, shifts);
+        for (size_t i = 0; i < count; i++)
+            memcpy(text + edits[i].start + shifts[i], t->arena + edits[i].text,
+                   edits[i].len);
+    }
+
+    // the new end of each tree edit is found in the new text. the edits are
+    // applied last to first, so the rows before each are still the old ones
+    for (size_t k = 0; k < tree_count; k++) {
+        TSInputEdit *edit = &tree_edits[k];
+        size_t first = tree_count == 1 ? 0 : regions[k].first_edit;
+        const char *start = text + edit->start_byte + shifts[first];
+        const char *end = start + (edit->new_end_byte - edit->start_byte);
+
+        edit->new_end_point = edit->start_point;
+        for (const char *c = start; c < end; c++) {
+            if (*c == '\n') {
+                edit->new_end_point.row++;
+                edit->new_end_point.column = 0;
+            } else {
+                edit->new_end_point.column++;
+            }
+        }
+    }
+    for (size_t k = tree_count; k-- > 0;) {
+        if (E.tree)
+            ts_tree_edit(E.tree, &tree_edits[k]);
+        if (!E.reparse_job.pending)
+            continue;
+        if (E.tree_edit_count == E.tree_edit_cap) {
+            E.tree_edit_cap = E.tree_edit_cap ? E.tree_edit_cap * 2 : 64;
+            E.tree_edits = mem_realloc(MEM_TREE, E.tree_edits,
+                                       sizeof(TSInputEdit) * E.tree_edit_cap);
+            if (!E.tree_edits)
+                die("realloc");
+        }
+        E.tree_edits[E.tree_edit_count++] = tree_edits[k];
+    }
+    mem_free(tree_edits);
+
+    if (text != E.text) {
+        if (E.text_mapped) {
+            munmap(E.text, E.text_cap);
+            mem_account(MEM_TEXT, -(int64_t) E.text_cap);
+        } else
+            mem_free(E.text);
+        E.text_mapped = false;
+    }
+    E.text = text;
+    E.text_cap = cap;
+    E.len_text = new_len;
+
+    // the edited regions are split into rows again, every other row keeps
+    // its hash, width and checkpoints
+    erow **region_rows = mem_malloc(MEM_ROWS, sizeof(erow *) * region_count);
+    uint64_t **region_hashes =
+            mem_malloc(MEM_INDEX, sizeof(uint64_t *) * region_count);
+    int *region_num_rows = mem_malloc(MEM_ROWS, sizeof(int) * region_count);
+    if (!region_rows || !region_hashes || !region_num_rows)
+        die("malloc");
+
+    int num_rows = E.num_rows;
+    for (size_t k = 0; k < region_count; k++) {
+        struct editRegion *region = &regions[k];
+        size_t start = region->start + shifts[region->first_edit];
+        size_t end = region->end + shifts[region->last_edit];
+        region_num_rows[k] = editorIndexRows(text + start, end - start, -1,
+                                             &region_rows[k],
+                                             &region_hashes[k]);
+        for (int i = 0; i < region_num_rows[k]; i++)
+            region_rows[k][i].start += start;
+        num_rows += region_num_rows[k] -
+                    (region->last_row - region->first_row);
+    }
+
+    // the rows the diff's copy of the hashes is missing
+    size_t first_row = regions[0].first_row;
+    size_t rows_after = E.num_rows - regions[region_count - 1].last_row;
+    if (first_row < E.diff_from)
+        E.diff_from = first_row;
+    if (rows_after < E.diff_tail)
+        E.diff_tail = rows_after;
+
+    bool same_rows = true;
+    for (size_t k = 0; k < region_count; k++)
+        same_rows &= region_num_rows[k] ==
+                     regions[k].last_row - regions[k].first_row;
+
+    if (same_rows) {
+        // the rows are patched in place, the rows between them only have
+        // their pending shift moved along
+        for (size_t k = 0; k < region_count; k++) {
+            int first = regions[k].first_row;
+            editorShiftRows(first);
+            for (int i = 0; i < region_num_rows[k]; i++) {
+                mem_free(E.row[first + i].checkpoints);
+                E.row[first + i] = region_rows[k][i];
+                E.hashes[first + i] = region_hashes[k][i];
+            }
+            E.shift_row = regions[k].last_row;
+            E.shift_delta += regions[k].delta;
+            for (int i = first; E.wrap && i < regions[k].last_row; i++)
+                wrap_layout_set_width(&E.layout, i,
+                                      editorRowByteToCol(&E.row[i],
+                                                         E.row[i].size));
+        }
+    } else {
+        // rows were inserted or removed, everything after them moves
+        erow *rows = mem_malloc(MEM_ROWS, sizeof(erow) * (num_rows + 1));
+        uint64_t *hashes =
+                mem_malloc(MEM_INDEX, sizeof(uint64_t) * (num_rows + 1));
+        uint32_t *widths =
+                E.wrap ? mem_malloc(MEM_INDEX,
+                                    sizeof(uint32_t) * (num_rows + 1))
+                       : NULL;
+        if (!rows || !hashes || (E.wrap && !widths))
+            die("malloc");
+
+        int out = 0;
+        int row = 0;
+        int64_t shift = 0;
+        for (size_t k = 0; k <= region_count; k++) {
+            int until = k < region_count ? regions[k].first_row : E.num_rows;
+            for (; row < until; row++, out++) {
+                rows[out] = E.row[row];
+                rows[out].start = editorRowStart(row) + shift;
+                hashes[out] = E.hashes[row];
+                if (widths)
+                    widths[out] = E.layout.widths[row];
+            }
+            if (k == region_count)
+                break;
+
+            for (; row < regions[k].last_row; row++)
+                mem_free(E.row[row].checkpoints);
+            regions[k].first_row = out; // where its widths are measured
+            for (int i = 0; i < region_num_rows[k]; i++, out++) {
+                rows[out] = region_rows[k][i];
+                hashes[out] = region_hashes[k][i];
+            }
+            shift = shifts[regions[k].last_edit];
+        }
+
+        mem_free(E.row);
+        mem_free(E.hashes);
+        E.row = rows;
+        E.hashes = hashes;
+        E.num_rows = num_rows;
+        E.shift_row = 0;
+        E.shift_delta = 0;
+        for (size_t k = 0; widths && k < region_count; k++) {
+            for (int i = 0; i < region_num_rows[k]; i++) {
+                int at = regions[k].first_row + i;
+                widths[at] = editorRowByteToCol(&E.row[at], E.row[at].size);
+            }
+        }
+        if (widths && wrap_layout_set_rows(&E.layout, widths, num_rows) == -1)
+            die("wrap_layout_set_rows");
+    }
+
+    for (size_t k = 0; k < region_count; k++) {
+        mem_free(region_rows[k]);
+        mem_free(region_hashes[k]);
+    }
+    mem_free(region_rows);
+    mem_free(region_hashes);
+    mem_free(region_num_rows);
+    mem_free(regions);
+    mem_free(shifts);
+
+    update_syntax_tree();
+    editorScheduleDiff();
+    editorJournalEdits(t);
+    snapshot_close(&E.snapshot); // its spans are for the old text
+    E.needs_redraw = true;
+
+    return 0;
+}
+
+// applies t as a single undo step
+int editorCommit(struct editorTransaction *t) {
+    struct editorTransaction inverse = {0};
+    if (editorApply(t, &inverse) == -1) {
+        editorTransactionFree(&inverse);
+        return -1;
+    }
+
+    undoStackPush(&E.undo, &inverse);
+    undoStackClear(&E.redo);
+
+    return 0;
+}
+
+// undoes the last step of from, recording how to redo it on to
+void editorUndoStep(struct undoStack *from, struct undoStack *to) {
+    if (from->count == 0)
+        return;
+
+    struct editorTransaction *t = &from->entries[--from->count];
+    struct editorTransaction inverse = {0};
+    if (editorApply(t, &inverse) == 0 && inverse.count > 0) {
+        editorSetCursorByte(inverse.edits[0].start);
+        undoStackPush(to, &inverse);
+    } else {
+        editorTransactionFree(&inverse);
+    }
+    editorTransactionFree(t);
+}
+
+// applies the journal's records as undo steps and returns how many there
+// were. the journal ends before a record that does not apply
+size_t editorReplayJournal(struct JournalReader *reader) {
+    // rows records need every row
+    if (E.load_job.pending) {
+        job_finish(&E.load_job);
+        editorPollJobs();
+    }
+
+    const struct JournalRecord *record;
+    const struct JournalEdit *edits;
+    const char *text;
+    size_t applied = 0;
+    size_t end = reader->offset;
+    while (journal_read_next(reader, &record, &edits, &text)) {
+        struct editorTransaction t = {0};
+        for (uint32_t i = 0; i < record->count; i++) {
+            size_t start = edits[i].start;
+            size_t stop = edits[i].end;
+            if (record->type == JOURNAL_ROWS) {
+                size_t rows = E.num_rows;
+                start = editorRowStart(start < rows ? start : rows);
+                stop = editorRowStart(stop < rows ? stop : rows);
+            }
+            editorTransactionReplace(&t, start, stop, text + edits[i].text,
+                                     edits[i].len);
+        }
+        int result = editorCommit(&t);
+        editorTransactionFree(&t);
+        if (result == -1)
+            break;
+        end = reader->offset;
+        applied++;
+    }
+    reader->end = end;
+    reader->records = applied;
+
+    return applied;
+}
+
+// y replays the journal and keeps appending to it, n starts a new one
+void editorRecoverKey(int c) {
+    if (c != 'y' && c != 'n' && c != '\x1b')
+        return;
+
+    char path[sizeof(E.journal.path)];
+    struct JournalHeader header = *E.recovery.header;
+    if (c == 'y') {
+        double start = elapsed_ms();
+        size_t applied = editorReplayJournal(&E.recovery);
+        snprintf(E.status, sizeof(E.status), "recovered %zu edits in %.1fms",
+                 applied, elapsed_ms() - start);
+    }
+    if (journal_path(E.filename, path, sizeof(path)) == -1 ||
+        journal_start(&E.journal, path, &header,
+                      c == 'y' ? &E.recovery : NULL) == -1)
+        snprintf(E.status, sizeof(E.status), "journal: %s", strerror(errno));
+    journal_read_close(&E.recovery);
+}
+
+// replaces every occurrence of find in one commit, returns how many there
+// were
+size_t editorReplaceAll(const char *find, size_t find_len, const char *with,
+                        size_t with_len) {
+    if (find_len == 0 || !E.text)
+        return 0;
+
+    struct editorTransaction t = {0};
+    const char *end = E.text + E.len_text;
+    const char *p = E.text;
+    while (end - p >= (ptrdiff_t) find_len) {
+        const char *hit = memchr(p, find[0], end - p - find_len + 1);
+        if (!hit)
+            break;
+        if (memcmp(hit, find, find_len) != 0) {
+            p = hit + 1;
+            continue;
+        }
+        editorTransactionReplace(&t, hit - E.text, hit - E.text + find_len,
+                                 with, with_len);
+        p = hit + find_len;
+    }
+
+    size_t hits = t.count;
+    if (hits > 0 && editorCommit(&t) == -1)
+        hits = 0;
+    editorTransactionFree(&t);
+
+    return hits;
+}
+
+void editorReplaceEdit(size_t start, size_t end, const char *text,
+                       size_t len) {
+    struct editorTransaction t = {0};
+    editorTransactionReplace(&t, start, end, text, len);
+    editorCommit(&t);
+    editorTransactionFree(&t);
+}
+
+void editorInsertKey(int c) {
+    size_t at = editorCursorByte();
+
+    switch (c) {
+        case '\x1b':
+            E.insert_mode = false;
+            return;
+        case '\r':
+            editorReplaceEdit(at, at, "\n", 1);
+            editorSetCursorByte(at + 1);
+            return;
+        case 127:
+        case ctrl('h'): {
+            if (at == 0)
+                return;
+            size_t from = at - 1;
+            while (from > 0 && (E.text[from] & 0xc0) == 0x80)
+                from--;
+            if (E.text[from] == '\n' && from > 0 && E.text[from - 1] == '\r')
+                from--;
+            editorReplaceEdit(from, at, "", 0);
+            editorSetCursorByte(from);
+            return;
+        }
+    }
+
+    // bytes of multibyte characters arrive one at a time, as negative chars
+    if (c == '\t' || (c >= ' ' && c < 127) || (c >= -128 && c < 0)) {
+        char byte = c;
+        editorReplaceEdit(at, at, &byte, 1);
+        editorSetCursorByte(at + 1);
+    }
+}
+
+void editorDeleteChar() {
+    int file_row = E.cy - 1;
+    if (file_row < 0 || file_row >= E.num_rows)
+        return;
+
+    erow *row = &E.row[file_row];
+    size_t col;
+    size_t at = editorRowColToByte(row, E.cx - 1, &col);
+    if (at >= row->size)
+        return;
+
+    wchar_t ch;
+    size_t n = decodeChar(editorRowChars(row) + at, row->size - at, &ch);
+    size_t start = editorRowStart(file_row) + at;
+    editorReplaceEdit(start, start + n, "", 0);
+    editorSetCursorByte(start);
+}
+
+// "find/with", split at the first slash
+void editorPromptKey(int c) {
+    switch (c) {
+        case '\x1b':
+            E.prompt_active = false;
+            break;
+        case '\r': {
+            E.prompt_active = false;
+            char *slash = memchr(E.prompt, '/', E.prompt_len);
+            if (!slash)
+                break;
+
+            double start = elapsed_ms();
+            size_t hits = editorReplaceAll(E.prompt, slash - E.prompt,
+                                           slash + 1,
+                                           E.prompt + E.prompt_len - slash - 1);
+            snprintf(E.status, sizeof(E.status), "replaced %zu in %.1fms",
+                     hits, elapsed_ms() - start);
+            break;
+        }
+        case 127:
+        case ctrl('h'):
+            if (E.prompt_len > 0)
+                E.prompt[--E.prompt_len] = '\0';
+            break;
+        default:
+            if (((c >= ' ' && c < 127) || (c >= -128 && c < 0)) &&
+                E.prompt_len < (int) sizeof(E.prompt) - 1) {
+                E.prompt[E.prompt_len++] = c;
+                E.prompt[E.prompt_len] = '\0';
+            }
+            break;
+    }
+}
+
+// the project index is mapped right away, so lookups work with the last
+// session's data while the index job reparses the files that changed
+void *update_symbols(void *arg) {
+    (void) arg;
+
+    if (symbol_index_update(&E.symbols, E.symbols_root, E.symbols_path) == 0)
+        symbol_index_open(&E.loaded_symbols, E.symbols_path);
+    job_advance(&E.index_job, 1);
+
+    return NULL;
+}
+
+// the nearest directory holding a .git, above the open file or else the
+// working directory
+int editorProjectRoot(char *root) {
+    if (!realpath(E.filename ? E.filename : ".", root))
+        return -1;
+
+    struct stat st;
+    if (stat(root, &st) == 0 && !S_ISDIR(st.st_mode))
+        *strrchr(root, '/') = '\0';
+
+    while (1) {
+        size_t len = strlen(root);
+        if (len + sizeof("/.git") > PATH_MAX)
+            return -1;
+        memcpy(root + len, "/.git", sizeof("/.git"));
+        bool found = stat(root, &st) == 0;
+        root[len] = '\0';
+        if (found)
+            return 0;
+
+        char *slash = strrchr(root, '/');
+        if (!slash || len <= 1)
+            return -1;
+        slash[slash == root ? 1 : 0] = '\0';
+    }
+}
+
+// the index is only built once a definition is looked up, and only for a
+// project, so starting in a home directory does not parse all of it. a file
+// of another project switches the index over once the job for the last one
+// is done. returns whether E.symbols is the open file's project's
+bool startSymbolIndex() {
+    char root[PATH_MAX];
+    if (editorProjectRoot(root) == -1) {
+        snprintf(E.status, sizeof(E.status), "symbols: no .git found");
+        return false;
+    }
+    if (strcmp(root, E.symbols_root) == 0)
+        return true;
+    if (E.index_job.pending) {
+        snprintf(E.status, sizeof(E.status), "symbols: indexing %.100s",
+                 E.symbols_root);
+        return false;
+    }
+    if (symbol_index_cache_path(root, E.symbols_path, sizeof(E.symbols_path)) ==
+        -1) {
+        snprintf(E.status, sizeof(E.status), "symbols: %s", strerror(errno));
+        return false;
+    }
+
+    snprintf(E.symbols_root, sizeof(E.symbols_root), "%s", root);
+    symbol_index_close(&E.symbols);
+    symbol_index_open(&E.symbols, E.symbols_path);
+    job_start(&E.index_job, update_symbols);
+    return true;
+}
+
+bool editorIsOpen(const char *path) {
+    struct stat st;
+    return E.filename && stat(path, &st) == 0 && st.st_dev == E.file_dev &&
+           st.st_ino == E.file_ino;
+}
+
+bool is_identifier_char(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// the path of the file symbol is defined in, paths in the index are
+// relative to the project root. too long a path comes back empty
+const char *editorSymbolPath(char *path, const struct Symbol *symbol) {
+    int len = snprintf(path, PATH_MAX, "%s/%s", E.symbols_root,
+                       symbol_index_string(&E.symbols,
+                                           E.symbols.files[symbol->file].path));
+    if (len < 0 || len >= PATH_MAX)
+        path[0] = '\0';
+    return path;
+}
+
+// jumps to the definition of the identifier under the cursor, preferring
+// one in the open file
+void editorGoToDefinition() {
+    int file_row = E.cy - 1;
+    if (file_row < 0 || file_row >= E.num_rows)
+        return;
+
+    erow *row = &E.row[file_row];
+    const char *chars = editorRowChars(row);
+    size_t col;
+    size_t file_col = editorRowColToByte(row, E.cx - 1, &col);
+    if (file_col >= row->size)
+        return;
+
+    size_t start = file_col;
+    size_t end = file_col;
+    while (start > 0 && is_identifier_char(chars[start - 1]))
+        start--;
+    while (end < row->size && is_identifier_char(chars[end]))
+        end++;
+    if (start == end)
+        return;
+
+    char path[PATH_MAX];
+    if (!startSymbolIndex())
+        return;
+    size_t first;
+    size_t count = symbol_index_find(&E.symbols, &chars[start],
+                                     end - start, &first);
+    if (count == 0) {
+        if (E.index_job.pending)
+            snprintf(E.status, sizeof(E.status), "symbols: indexing %.100s",
+                     E.symbols_root);
+        return;
+    }
+
+    const struct Symbol *target = symbol_index_at(&E.symbols, first);
+    for (size_t i = 0; i < count; i++) {
+        const struct Symbol *symbol = symbol_index_at(&E.symbols, first + i);
+        if (editorIsOpen(editorSymbolPath(path, symbol))) {
+            target = symbol;
+            break;
+        }
+    }
+
+    editorSymbolPath(path, target);
+    if (!editorIsOpen(path)) {
+        if (access(path, R_OK) != 0)
+            return;
+        editorClose();
+        editorOpen(path, target->row);
+        init_tree_sitter(path);
+    }
+
+    E.cy = target->row + 1;
+    E.cx = 1;
+    if (target->row < (uint32_t) E.num_rows)
+        E.cx = editorRowByteToCol(&E.row[target->row], target->column) + 1;
+    E.needs_redraw = true;
+}
+
+
+// the file list from the last walk is searched right away while a new walk
+// picks up files created since
+void editorOpenPicker() {
+    E.picker_active = true;
+    E.picker_query_len = 0;
+    E.picker_query[0] = '\0';
+    E.picker_selected = 0;
+
+    if (!E.walk_job.pending)
+        job_start(&E.walk_job, walk_files);
+    editorPickerSearch();
+}
+
+void editorPickerKey(int c) {
+    switch (c) {
+        case '\x1b':
+            E.picker_active = false;
+            break;
+        case '\r': {
+            if (E.finder.top_count == 0)
+                break;
+            const char *path = file_list_path(
+                    &E.files, E.finder.top[E.picker_selected].file);
+            E.picker_active = false;
+            if (access(path, R_OK) != 0 || editorIsOpen(path))
+                break;
+            editorClose();
+            editorOpen(path, 0);
+            init_tree_sitter(path);
+            break;
+        }
+        case 127:
+        case ctrl('h'):
+            if (E.picker_query_len > 0) {
+                E.picker_query[--E.picker_query_len] = '\0';
+                editorPickerSearch();
+            }
+            break;
+        case KEY_ARROW_UP:
+        case ctrl('p'):
+            if (E.picker_selected > 0)
+                E.picker_selected--;
+            break;
+        case KEY_ARROW_DOWN:
+        case ctrl('n'):
+            if (E.picker_selected + 1 < (int) E.finder.top_count)
+                E.picker_selected++;
+            break;
+        default:
+            if (c >= ' ' && c < 127 &&
+                E.picker_query_len < (int) sizeof(E.picker_query) - 1) {
+                E.picker_query[E.picker_query_len++] = c;
+                E.picker_query[E.picker_query_len] = '\0';
+                editorPickerSearch();
+            }
+            break;
+    }
+}
+
+void drawText(int x, int y, int width, const char *text, Style style) {
+    size_t len = strlen(text);
+    for (int i = 0; i < width; i++) {
+        terminal_cell_set(x + i, y,
+                          (struct Cell){
+                                  .ch = i < (int) len ? text[i] : ' ',
+                                  .s = style,
+                          });
+    }
+}
+
+// the picker covers the text area: the query on the first row and the best
+// matches below it
+void editorDrawPicker() {
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    int text_cols = E.screen_cols - E.x_start_offset - E.x_end_offset;
+    char line[512];
+
+    if (E.finder.files)
+        snprintf(line, sizeof(line), "> %-*s %zu/%zu (%.1fms)",
+                 E.picker_query_len, E.picker_query, E.finder.match_count,
+                 E.files.count, E.picker_ms);
+    else
+        snprintf(line, sizeof(line), "> %s (indexing...)", E.picker_query);
+    drawText(E.x_start_offset, E.y_start_offset, text_cols, line, ST_NORMAL);
+
+    for (int y = 1; y < text_rows; y++) {
+        const char *path = "";
+        Style style = ST_NORMAL;
+        if (y - 1 < (int) E.finder.top_count) {
+            path = file_list_path(&E.files, E.finder.top[y - 1].file);
+            if (y - 1 == E.picker_selected)
+                style.attr |= INVERSE;
+        }
+        drawText(E.x_start_offset, E.y_start_offset + y, text_cols, path,
+                 style);
+    }
+
+    terminal_move_cursor(E.x_start_offset + 3 + E.picker_query_len,
+                         E.y_start_offset + 1);
+}
+
+
+// steps over characters rather than columns, so the cursor never lands
+// inside a tab or a multibyte character
+void editorMoveCursorHorizontal(int value) {
+    int file_row = E.cy - 1;
+    if (file_row < 0 || file_row >= E.num_rows)
+        return;
+
+    erow *row = &E.row[file_row];
+    const char *chars = editorRowChars(row);
+    size_t col;
+    size_t pos = editorRowColToByte(row, E.cx - 1, &col);
+    for (; value > 0 && pos < row->size; value--) {
+        wchar_t ch;
+        pos += decodeChar(&chars[pos], row->size - pos, &ch);
+    }
+    for (; value < 0 && pos > 0; value++) {
+        pos--;
+        while (pos > 0 && (chars[pos] & 0xc0) == 0x80)
+            pos--;
+    }
+
+    E.cx = editorRowByteToCol(row, pos) + 1;
+}
+
+void editorMoveCursor(direction dir, int value) {
+    switch (dir) {
+        case HORIZONTAL:
+            editorMoveCursorHorizontal(value);
+            break;
+        case VERTICAL:
+            E.cy += value;
+            break;
+    }
+}
+
+// the display line the cursor is on in wrap mode, *sub is set to the
+// wrapped line within its row and *col to the cursor's column on it. past
+// the end of a row that fills its last line, the cursor stays on that line
+size_t editorWrapCursorLine(size_t *sub, size_t *col) {
+    *sub = (E.cx - 1) / E.layout.cols;
+    size_t lines = wrap_layout_lines(&E.layout, E.cy - 1);
+    if (*sub >= lines)
+        *sub = lines - 1;
+    *col = (E.cx - 1) - *sub * E.layout.cols;
+    if (*col >= (size_t) E.layout.cols)
+        *col = E.layout.cols - 1;
+
+    return wrap_layout_line_of(&E.layout, E.cy - 1) + *sub;
+}
+
+// ctrl-d and ctrl-u page through display lines in wrap mode, so a long
+// wrapped row is paged through rather than jumped over
+void editorPageCursor(int value) {
+    if (!E.wrap || E.num_rows == 0) {
+        editorMoveCursor(VERTICAL, value);
+        return;
+    }
+
+    size_t sub;
+    size_t col;
+    int64_t line = (int64_t) editorWrapCursorLine(&sub, &col) + value;
+
+    E.cy = wrap_layout_row_at(&E.layout, line < 0 ? 0 : line, &sub) + 1;
+    E.cx = sub * E.layout.cols + col + 1;
+}
+
+void editorScrollWrapped() {
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    size_t sub;
+    size_t col;
+    size_t cursor = editorWrapCursorLine(&sub, &col);
+    size_t top = wrap_layout_line_of(&E.layout, E.row_offset) + E.row_sub;
+
+    if (cursor < top)
+        top = cursor;
+    if (text_rows > 0 && cursor >= top + text_rows)
+        top = cursor - text_rows + 1;
+
+    E.row_offset = wrap_layout_row_at(&E.layout, top, &E.row_sub);
+    E.col_offset = 0;
+}
+
+void editorScroll() {
+    int text_rows = E.screen_rows - E.y_start_offset - E.y_end_offset;
+    int text_cols = E.screen_cols - E.x_start_offset - E.x_end_offset;
+
+    if (E.cy < 1) {
+        E.cy = 1;
+    }
+    if (E.cy > E.num_rows) {
+        E.cy = E.num_rows;
+    }
+    if (E.cx < 1) {
+        E.cx = 1;
+    }
+    if (E.wrap && E.num_rows > 0) {
+        editorScrollWrapped();
+        return;
+    }
+
+    if (E.cy - E.row_offset > text_rows) {
+        E.row_offset += E.cy - E.row_offset - text_rows;
+    }
+    if (E.cy - E.row_offset < 1) {
+        E.row_offset += E.cy - E.row_offset - 1;
+    }
+
+    if (E.cx - E.col_offset > text_cols) {
+        E.col_offset = E.cx - text_cols;
+    }
+    if (E.cx - E.col_offset < 1) {
+        E.col_offset = E.cx - 1;
+    }
+}
+
+void editorRefreshScreen() {
+    editorScroll();
+    if (E.wrap && E.num_rows > 0) {
+        size_t sub;
+        size_t col;
+        size_t line = editorWrapCursorLine(&sub, &col);
+        size_t top = wrap_layout_line_of(&E.layout, E.row_offset) + E.row_sub;
+        terminal_move_cursor(E.x_start_offset + col + 1,
+                             E.y_start_offset + line - top + 1);
+    } else {
+        terminal_move_cursor(E.x_start_offset + E.cx - E.col_offset,
+                             E.y_start_offset + E.cy - E.row_offset);
+    }
+    debug();
+    editorDrawLines();
+    editorDrawGutter();
+    editorHighlightSyntax();
+    if (E.picker_active)
+        editorDrawPicker();
+    terminal_refresh();
+    E.needs_redraw = false;
+
+    if (E.first_frame_ms == 0)
+        E.first_frame_ms = elapsed_ms();
+    if (E.highlighted_frame_ms == 0 &&
+        ((E.tree && E.highlighting) || E.snapshot.map))
+        E.highlighted_frame_ms = elapsed_ms();
+}
+
+void editorResize() {
+    terminal_get_size(&E.screen_cols, &E.screen_rows);
+    E.screen_rows -= 1;
+
+    E.windows = mem_realloc(MEM_CELLS, E.windows,
+                            sizeof(struct rowWindow) * (E.screen_rows + 1));
+    if (!E.windows)
+        die("realloc");
+
+    if (E.wrap)
+        wrap_layout_set_cols(&E.layout, E.screen_cols - E.x_start_offset -
+                                                E.x_end_offset);
+    if (E.finder.files && finder_set_top(&E.finder, editorPickerRows()) == 0)
+        editorPickerSearch();
+    E.needs_redraw = true;
+}
+
+// a subsystem over its soft limit, or any while the total is, gives up what
+// can be rebuilt: snapshots, checkpoints off screen and the hashes of an
+// idle diff. undo history is only trimmed when its own limit is passed
+void editorEnforceMemoryLimits() {
+    static size_t swept_rows; // checkpoint bytes left by the last sweep
+    bool total = mem_over_limit(MEM_TOTAL);
+
+    if ((total || mem_over_limit(MEM_HIGHLIGHT)) && E.snapshot.map) {
+        snapshot_close(&E.snapshot);
+        E.needs_redraw = true;
+    }
+
+    if ((total || mem_over_limit(MEM_ROWS)) &&
+        mem_used(MEM_ROWS) > swept_rows) {
+        int first = E.row_offset;
+        int last = E.row_offset + E.screen_rows;
+        for (int i = 0; i < E.num_rows; i++) {
+            if (i >= first && i < last)
+                continue;
+            mem_free(E.row[i].checkpoints);
+            E.row[i].checkpoints = NULL;
+        }
+        swept_rows = mem_used(MEM_ROWS);
+    }
+
+    // the next diff hashes the file again. base_count and diff_count stay,
+    // they are what the shown diff was computed from and compaction reads
+    if (!E.diff_job.pending && (total || mem_over_limit(MEM_INDEX))) {
+        mem_free(E.base_hashes);
+        E.base_hashes = NULL;
+    }
+    if (!E.diff_job.pending && (total || mem_over_limit(MEM_DIFF))) {
+        mem_free(E.diff_hashes);
+        E.diff_hashes = NULL;
+        E.diff_cap = 0;
+    }
+
+    while (mem_over_limit(MEM_UNDO) && E.undo.count + E.redo.count > 0) {
+        undoStackTrim(&E.redo, 1);
+        if (mem_over_limit(MEM_UNDO))
+            undoStackTrim(&E.undo, 1);
+    }
+}
+
+void editorDumpMemory() {
+    char path[4096];
+    if (mem_dump_path(path, sizeof(path)) == -1) {
+        snprintf(E.status, sizeof(E.status), "memory: %s", strerror(errno));
+        return;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        snprintf(E.status, sizeof(E.status), "memory: %s", strerror(errno));
+        return;
+    }
+    bool failed = mem_dump(file) == -1;
+    if (fclose(file) == EOF || failed) {
+        snprintf(E.status, sizeof(E.status), "memory: %s", strerror(errno));
+        return;
+    }
+    snprintf(E.status, sizeof(E.status), "memory: %.100s", path);
+}
+
+void editorReadEvent() {
+    int c = terminal_read_input();
+
+    if (c == KEY_WAKE) {
+        editorPollJobs();
+        return;
+    }
+    if (c == KEY_RESIZE) {
+        // a resize may have swallowed a job's wake up
+        editorResize();
+        editorPollJobs();
+        return;
+    }
+    E.status[0] = '\0';
+    if (E.recovery.map) {
+        editorRecoverKey(c);
+        return;
+    }
+    if (E.picker_active) {
+        editorPickerKey(c);
+        return;
+    }
+    if (E.prompt_active) {
+        editorPromptKey(c);
+        return;
+    }
+    if (E.insert_mode) {
+        editorInsertKey(c);
+        return;
+    }
+
+    switch (c) {
+        case 'q':
+            exit(0);
+        case 'h':
+            editorMoveCursor(HORIZONTAL, -1);
+            break;
+        case 'j':
+            editorMoveCursor(VERTICAL, 1);
+            break;
+        case 'k':
+            editorMoveCursor(VERTICAL, -1);
+            break;
+        case 'l':
+            editorMoveCursor(HORIZONTAL, 1);
+            break;
+        case ctrl('u'):
+            editorPageCursor(-34);
+            break;
+        case ctrl('d'):
+            editorPageCursor(34);
+            break;
+        case 'i':
+            E.insert_mode = true;
+            break;
+        case 'x':
+            editorDeleteChar();
+            break;
+        case 'u':
+            editorUndoStep(&E.undo, &E.redo);
+            break;
+        case ctrl('r'):
+            editorUndoStep(&E.redo, &E.undo);
+            break;
+        case 'R':
+            E.prompt_active = true;
+            E.prompt_len = 0;
+            E.prompt[0] = '\0';
+            break;
+        case 'w':
+            E.wrap = !E.wrap;
+            E.row_sub = 0;
+            E.col_offset = 0;
+            editorLayoutRows();
+            break;
+        case 'm':
+            mem_summary(E.status, sizeof(E.status));
+            break;
+        case 'M':
+            editorDumpMemory();
+            break;
+        case ctrl(']'):
+            editorGoToDefinition();
+            break;
+        case ctrl('p'):
+            editorOpenPicker();
+            break;
+    }
+}
+
+
+void initEditor() {
+    terminal_get_size(&E.screen_cols, &E.screen_rows);
+    E.load_fd = -1;
+    E.cx = 1;
+    E.cy = 1;
+
+    E.x_start_offset = 5;
+    E.x_end_offset = 5;
+    E.y_start_offset = 5;
+    E.y_end_offset = 5;
+
+    E.num_rows = 0;
+    E.row_offset = 0;
+    E.col_offset = 0;
+    E.needs_redraw = true;
+
+    E.screen_rows -= 1;
+
+    E.row = NULL;
+    E.windows = mem_calloc(MEM_CELLS, E.screen_rows, sizeof(struct rowWindow));
+    if (!E.windows)
+        die("calloc");
+}
+
+
+int main(int argc, char *argv[]) {
+    clock_gettime(CLOCK_MONOTONIC, &E.start_time);
+    mem_use_for_tree_sitter();
+    bool bad_limits = mem_load_limits() == -1;
 
-int main(int argc, char *argv[]) {
     enableRawMode();
+    atexit(editorCloseJournal);
+    atexit(editorSaveSnapshot);
     initEditor();
     if (argc >= 2) {
-        init_tree_sitter();
-        editorOpen(argv[1]);
-        update_syntax_tree();
+        editorOpen(argv[1], 0);
+        init_tree_sitter(argv[1]);
     }
+    if (bad_limits)
+        snprintf(E.status, sizeof(E.status), "memory: bad limits in config");
 
 
     while (1) {
         editorRefreshScreen();
         editorReadEvent();
+        editorEnforceMemoryLimits();
     }
     return 0;
 }
@@ -0,0 +1,283 @@
+#include "mem.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tree_sitter/api.h"
+#include "util.h"
+
+// every block starts with its size and where it is counted, so it can be
+// freed without knowing either
+union memHeader {
+    struct {
+        size_t size;
+        enum memSubsystem subsystem;
+    };
+    max_align_t align; // keeps the block after it aligned like malloc's
+};
+
+static atomic_size_t used[MEM_TOTAL];
+static size_t limits[MEM_TOTAL + 1]; // 0 is no limit
+
+static const char *const names[MEM_TOTAL + 1] = {
+        [MEM_TEXT] = "text",           [MEM_ROWS] = "rows",
+        [MEM_INDEX] = "index",         [MEM_TREE] = "tree",
+        [MEM_HIGHLIGHT] = "highlight", [MEM_UNDO] = "undo",
+        [MEM_DIFF] = "diff",           [MEM_JOURNAL] = "journal",
+        [MEM_CELLS] = "cells",         [MEM_TOTAL] = "total",
+};
+
+void *mem_malloc(enum memSubsystem subsystem, size_t size) {
+    if (size > SIZE_MAX - sizeof(union memHeader)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    union memHeader *header = malloc(sizeof(*header) + size);
+    if (!header)
+        return NULL;
+    header->size = size;
+    header->subsystem = subsystem;
+    atomic_fetch_add_explicit(&used[subsystem], size, memory_order_relaxed);
+
+    return header + 1;
+}
+
+void *mem_calloc(enum memSubsystem subsystem, size_t count, size_t size) {
+    if (size > 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void *ptr = mem_malloc(subsystem, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+// a block stays counted where it was first allocated
+void *mem_realloc(enum memSubsystem subsystem, void *ptr, size_t size) {
+    if (!ptr)
+        return mem_malloc(subsystem, size);
+    if (size > SIZE_MAX - sizeof(union memHeader)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    union memHeader *header = (union memHeader *) ptr - 1;
+    size_t old_size = header->size;
+    header = realloc(header, sizeof(*header) + size);
+    if (!header)
+        return NULL;
+    header->size = size;
+    atomic_fetch_add_explicit(&used[header->subsystem], size - old_size,
+                              memory_order_relaxed);
+
+    return header + 1;
+}
+
+void mem_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    union memHeader *header = (union memHeader *) ptr - 1;
+    atomic_fetch_sub_explicit(&used[header->subsystem], header->size,
+                              memory_order_relaxed);
+    free(header);
+}
+
+// counts memory that does not come from mem_malloc(), bytes is negative
+// when it is released
+void mem_account(enum memSubsystem subsystem, int64_t bytes) {
+    atomic_fetch_add_explicit(&used[subsystem], (size_t) bytes,
+                              memory_order_relaxed);
+}
+
+// tree-sitter aborts when it runs out of memory, so these do too
+static void *tree_malloc(size_t size) {
+    void *ptr = mem_malloc(MEM_TREE, size);
+    if (!ptr)
+        abort();
+    return ptr;
+}
+
+static void *tree_calloc(size_t count, size_t size) {
+    void *ptr = mem_calloc(MEM_TREE, count, size);
+    if (!ptr)
+        abort();
+    return ptr;
+}
+
+static void *tree_realloc(void *ptr, size_t size) {
+    ptr = mem_realloc(MEM_TREE, ptr, size);
+    if (!ptr)
+        abort();
+    return ptr;
+}
+
+// must run before tree-sitter allocates anything
+void mem_use_for_tree_sitter(void) {
+    ts_set_allocator(tree_malloc, tree_calloc, tree_realloc, mem_free);
+}
+
+size_t mem_used(enum memSubsystem subsystem) {
+    if (subsystem != MEM_TOTAL)
+        return atomic_load_explicit(&used[subsystem], memory_order_relaxed);
+
+    size_t total = 0;
+    for (int i = 0; i < MEM_TOTAL; i++)
+        total += atomic_load_explicit(&used[i], memory_order_relaxed);
+    return total;
+}
+
+const char *mem_name(enum memSubsystem subsystem) {
+    return names[subsystem];
+}
+
+size_t mem_limit(enum memSubsystem subsystem) {
+    return limits[subsystem];
+}
+
+bool mem_over_limit(enum memSubsystem subsystem) {
+    return limits[subsystem] > 0 && mem_used(subsystem) > limits[subsystem];
+}
+
+// parses "<subsystem> <bytes>[K|M|G]" and sets that soft limit
+static int parse_limit(const char *line) {
+    char name[32];
+    unsigned long long bytes;
+    char unit = '\0';
+    int fields = sscanf(line, " %31s %llu%c", name, &bytes, &unit);
+    if (fields < 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (fields == 3 ? toupper((unsigned char) unit) : '\0') {
+        case 'G':
+            bytes <<= 10;
+            // fall through
+        case 'M':
+            bytes <<= 10;
+            // fall through
+        case 'K':
+            bytes <<= 10;
+            break;
+        default:
+            if (fields == 3 && !isspace((unsigned char) unit)) {
+                errno = EINVAL;
+                return -1;
+            }
+            break;
+    }
+
+    for (int i = 0; i <= MEM_TOTAL; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            limits[i] = bytes;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+// reads the soft limits from $XDG_CONFIG_HOME/LiteEdit/memory, one
+// "<subsystem> <bytes>" per line. no file means no limits
+int mem_load_limits(void) {
+    char path[4096];
+    const char *config = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+
+    if (config && *config)
+        snprintf(path, sizeof(path), "%s/LiteEdit/memory", config);
+    else if (home)
+        snprintf(path, sizeof(path), "%s/.config/LiteEdit/memory", home);
+    else
+        return 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return errno == ENOENT ? 0 : -1;
+
+    char line[256];
+    int result = 0;
+    while (fgets(line, sizeof(line), file)) {
+        const char *p = line;
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (parse_limit(p) == -1)
+            result = -1;
+    }
+    fclose(file);
+
+    if (result == -1)
+        errno = EINVAL;
+    return result;
+}
+
+// $XDG_STATE_HOME/LiteEdit/memory.<pid>.tsv, for mem_dump()
+int mem_dump_path(char *path, size_t size) {
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+
+    if (state && *state)
+        len = snprintf(path, size, "%s/LiteEdit/memory.%d.tsv", state,
+                       (int) getpid());
+    else if (home)
+        len = snprintf(path, size, "%s/.local/state/LiteEdit/memory.%d.tsv",
+                       home, (int) getpid());
+    else {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return util_make_dirs(path);
+}
+
+static void format_size(char *buf, size_t size, size_t bytes) {
+    if (bytes < 1024)
+        snprintf(buf, size, "%zu", bytes);
+    else if (bytes < 1024 * 1024)
+        snprintf(buf, size, "%.1fK", bytes / 1024.0);
+    else if (bytes < 1024 * 1024 * 1024)
+        snprintf(buf, size, "%.1fM", bytes / (1024.0 * 1024));
+    else
+        snprintf(buf, size, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+}
+
+// one line for the status bar, "text 1.2M rows 80.0K ... total 9.1M"
+int mem_summary(char *buf, size_t size) {
+    size_t len = 0;
+    for (int i = 0; i <= MEM_TOTAL && len < size; i++) {
+        char bytes[16];
+        format_size(bytes, sizeof(bytes), mem_used(i));
+        int n = snprintf(buf + len, size - len, "%s%s %s", i ? " " : "",
+                         names[i], bytes);
+        if (n < 0)
+            return -1;
+        len += n;
+    }
+
+    return 0;
+}
+
+// tab separated, one subsystem per line: name, bytes used, soft limit
+int mem_dump(FILE *file) {
+    fprintf(file, "subsystem\tbytes\tlimit\n");
+    for (int i = 0; i <= MEM_TOTAL; i++)
+        fprintf(file, "%s\t%zu\t%zu\n", names[i], mem_used(i), limits[i]);
+
+    return ferror(file) ? -1 : 0;
+}
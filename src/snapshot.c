@@ -0,0 +1,128 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mem.h"
+#include "util.h"
+
+// $XDG_CACHE_HOME/LiteEdit/highlights/<hash of the file's real path>.hl
+int snapshot_cache_path(const char *filename, char *path, size_t size) {
+    char real_path[PATH_MAX];
+    if (!realpath(filename, real_path))
+        return -1;
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    uint64_t hash = util_hash(UTIL_HASH_SEED, real_path, strlen(real_path));
+    int len;
+
+    if (cache && *cache)
+        len = snprintf(path, size, "%s/LiteEdit/highlights/%016llx.hl",
+                       cache, (unsigned long long) hash);
+    else if (home)
+        len = snprintf(path, size, "%s/.cache/LiteEdit/highlights/%016llx.hl",
+                       home, (unsigned long long) hash);
+    else {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return util_make_dirs(path);
+}
+
+// maps the snapshot at path if it was taken from a file of this size and
+// mtime whose first bytes are still those of text
+int snapshot_open(struct Snapshot *snapshot, const char *path, int64_t size,
+                  struct timespec mtime, const char *text, size_t len) {
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < (off_t) sizeof(struct SnapshotHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const struct SnapshotHeader *header = map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        (size_t) st.st_size !=
+                sizeof(*header) +
+                        (size_t) header->span_count *
+                                sizeof(struct SnapshotSpan)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (header->size != size || header->mtime_sec != mtime.tv_sec ||
+        header->mtime_nsec != mtime.tv_nsec || header->covered > len ||
+        header->hash != util_hash(UTIL_HASH_SEED, text, header->covered)) {
+        munmap(map, st.st_size);
+        errno = ESTALE;
+        return -1;
+    }
+
+    snapshot->map = map;
+    snapshot->map_size = st.st_size;
+    mem_account(MEM_HIGHLIGHT, st.st_size);
+    snapshot->header = header;
+    snapshot->spans = (const struct SnapshotSpan *) (header + 1);
+
+    return 0;
+}
+
+// written next to the old snapshot and renamed over it, so a snapshot that
+// is still mapped is not affected
+int snapshot_write(const char *path, const struct SnapshotHeader *header,
+                   const struct SnapshotSpan *spans) {
+    struct SnapshotHeader out = *header;
+    memcpy(out.magic, SNAPSHOT_MAGIC, sizeof(out.magic));
+    out.version = SNAPSHOT_VERSION;
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return -1;
+
+    size_t spans_size = out.span_count * sizeof(*spans);
+    int failed = util_write_all(fd, &out, sizeof(out)) == -1 ||
+                 util_write_all(fd, spans, spans_size) == -1;
+    if (close(fd) == -1 || failed || rename(tmp_path, path) == -1) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+void snapshot_close(struct Snapshot *snapshot) {
+    if (snapshot->map) {
+        munmap(snapshot->map, snapshot->map_size);
+        mem_account(MEM_HIGHLIGHT, -(int64_t) snapshot->map_size);
+    }
+    memset(snapshot, 0, sizeof(*snapshot));
+}
@@ -0,0 +1,673 @@
+#include "symbols.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "finder.h"
+#include "language.h"
+#include "mem.h"
+#include "util.h"
+
+#define MAX_WORKERS 64
+
+// one source file of the project while the index is rebuilt
+struct indexEntry {
+    char *path; // relative to the project root
+    int64_t mtime;
+    int64_t size;
+    uint64_t hash;
+    struct Language *lang;
+    const struct SymbolFile *old; // unchanged entry of the previous index
+    struct Symbol *symbols;       // names are offsets into names
+    uint32_t symbol_count;
+    uint32_t symbol_cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+};
+
+struct entryList {
+    struct indexEntry *entries;
+    size_t count;
+    size_t cap;
+};
+
+struct indexWork {
+    const char *root;
+    struct indexEntry **pending;
+    size_t pending_count;
+    atomic_size_t next;
+};
+
+// $XDG_CACHE_HOME/LiteEdit/symbols/<hash of the project root>.idx
+int symbol_index_cache_path(const char *root, char *path, size_t size) {
+    char real_root[PATH_MAX];
+    if (!realpath(root, real_root))
+        return -1;
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    uint64_t hash = util_hash(UTIL_HASH_SEED, real_root, strlen(real_root));
+    int len;
+
+    if (cache && *cache)
+        len = snprintf(path, size, "%s/LiteEdit/symbols/%016llx.idx", cache,
+                       (unsigned long long) hash);
+    else if (home)
+        len = snprintf(path, size, "%s/.cache/LiteEdit/symbols/%016llx.idx",
+                       home, (unsigned long long) hash);
+    else {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return util_make_dirs(path);
+}
+
+// every offset and id in the mapped index must point inside it
+static bool index_in_range(const struct SymbolIndex *index) {
+    const struct SymbolIndexHeader *header = index->header;
+
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        const struct SymbolFile *file = &index->files[i];
+        if (file->path >= header->strings_size ||
+            (uint64_t) file->first_symbol + file->symbol_count >
+                    header->symbol_count)
+            return false;
+    }
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        const struct Symbol *symbol = &index->symbols[i];
+        if (symbol->name >= header->strings_size ||
+            symbol->file >= header->file_count ||
+            index->by_name[i] >= header->symbol_count)
+            return false;
+    }
+
+    return true;
+}
+
+int symbol_index_open(struct SymbolIndex *index, const char *path) {
+    memset(index, 0, sizeof(*index));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < (off_t) sizeof(struct SymbolIndexHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const struct SymbolIndexHeader *header = map;
+    size_t expected = sizeof(*header) +
+                      (size_t) header->file_count * sizeof(struct SymbolFile) +
+                      (size_t) header->symbol_count * sizeof(struct Symbol) +
+                      (size_t) header->symbol_count * sizeof(uint32_t) +
+                      header->strings_size;
+    if (memcmp(header->magic, SYMBOL_INDEX_MAGIC, 8) != 0 ||
+        header->version != SYMBOL_INDEX_VERSION ||
+        expected != (size_t) st.st_size ||
+        (header->strings_size > 0 &&
+         ((const char *) map)[st.st_size - 1] != '\0')) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = header;
+    index->files = (const struct SymbolFile *) (header + 1);
+    index->symbols =
+            (const struct Symbol *) (index->files + header->file_count);
+    index->by_name = (const uint32_t *) (index->symbols + header->symbol_count);
+    index->strings = (const char *) (index->by_name + header->symbol_count);
+    if (!index_in_range(index)) {
+        symbol_index_close(index);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void symbol_index_close(struct SymbolIndex *index) {
+    if (index->map)
+        munmap(index->map, index->map_size);
+    memset(index, 0, sizeof(*index));
+}
+
+const char *symbol_index_string(const struct SymbolIndex *index,
+                                uint32_t offset) {
+    if (!index->header || offset >= index->header->strings_size)
+        return "";
+
+    return &index->strings[offset];
+}
+
+size_t symbol_index_count(const struct SymbolIndex *index) {
+    return index->header ? index->header->symbol_count : 0;
+}
+
+// the i-th symbol in name order
+const struct Symbol *symbol_index_at(const struct SymbolIndex *index,
+                                     size_t i) {
+    return &index->symbols[index->by_name[i]];
+}
+
+static int compare_name(const char *str, const char *name, size_t len) {
+    int cmp = strncmp(str, name, len);
+    if (cmp != 0)
+        return cmp;
+
+    return str[len] != '\0';
+}
+
+// returns how many symbols are called name, the first one is at
+// symbol_index_at(index, *first)
+size_t symbol_index_find(const struct SymbolIndex *index, const char *name,
+                         size_t len, size_t *first) {
+    size_t lo = 0;
+    size_t hi = symbol_index_count(index);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *str = symbol_index_string(
+                index, symbol_index_at(index, mid)->name);
+        if (compare_name(str, name, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *first = lo;
+    size_t end = lo;
+    while (end < symbol_index_count(index) &&
+           compare_name(symbol_index_string(
+                                index, symbol_index_at(index, end)->name),
+                        name, len) == 0)
+        end++;
+
+    return end - lo;
+}
+
+static const struct SymbolFile *find_file(const struct SymbolIndex *index,
+                                          const char *path) {
+    if (!index || !index->header)
+        return NULL;
+
+    size_t lo = 0;
+    size_t hi = index->header->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(symbol_index_string(index, index->files[mid].path),
+                         path);
+        if (cmp == 0)
+            return &index->files[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+static int list_append(struct entryList *list, const char *path,
+                       const struct stat *st, struct Language *lang) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        struct indexEntry *entries = mem_realloc(MEM_INDEX, list->entries,
+                                                 cap * sizeof(*entries));
+        if (!entries)
+            return -1;
+        list->entries = entries;
+        list->cap = cap;
+    }
+
+    struct indexEntry *entry = &list->entries[list->count];
+    memset(entry, 0, sizeof(*entry));
+    size_t len = strlen(path);
+    entry->path = mem_malloc(MEM_INDEX, len + 1);
+    if (!entry->path)
+        return -1;
+    memcpy(entry->path, path, len + 1);
+    entry->mtime = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    entry->size = st->st_size;
+    entry->lang = lang;
+    list->count++;
+
+    return 0;
+}
+
+// collects every file below root that has a language with a tags query.
+// the walk is the file picker's, so ignore files are honoured the same way
+static int collect_files(const char *root, struct entryList *list) {
+    struct FileList files;
+    if (file_list_walk(&files, root) == -1)
+        return -1;
+
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        file_list_free(&files);
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < files.count && result == 0; i++) {
+        const char *path = file_list_path(&files, i);
+        const char *name = strrchr(path, '/');
+        struct Language *lang =
+                language_detect(name ? name + 1 : path, NULL, 0);
+        if (!lang || !language_tags_query(lang))
+            continue;
+
+        struct stat st;
+        if (fstatat(root_fd, path, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+            !S_ISREG(st.st_mode))
+            continue;
+        result = list_append(list, path, &st, lang);
+    }
+
+    close(root_fd);
+    file_list_free(&files);
+    return result;
+}
+
+static int add_symbol(struct indexEntry *entry, const char *name, size_t len,
+                      TSPoint point, uint32_t kind) {
+    if (entry->symbol_count == entry->symbol_cap) {
+        uint32_t cap = entry->symbol_cap ? entry->symbol_cap * 2 : 16;
+        struct Symbol *symbols = mem_realloc(MEM_INDEX, entry->symbols,
+                                             cap * sizeof(*symbols));
+        if (!symbols)
+            return -1;
+        entry->symbols = symbols;
+        entry->symbol_cap = cap;
+    }
+
+    if (entry->names_len + len + 1 > entry->names_cap) {
+        size_t cap = entry->names_cap ? entry->names_cap * 2 : 256;
+        while (cap < entry->names_len + len + 1)
+            cap *= 2;
+        char *names = mem_realloc(MEM_INDEX, entry->names, cap);
+        if (!names)
+            return -1;
+        entry->names = names;
+        entry->names_cap = cap;
+    }
+
+    entry->symbols[entry->symbol_count++] = (struct Symbol){
+            .name = entry->names_len,
+            .row = point.row,
+            .column = point.column,
+            .kind = kind,
+    };
+    memcpy(&entry->names[entry->names_len], name, len);
+    entry->names_len += len;
+    entry->names[entry->names_len++] = '\0';
+
+    return 0;
+}
+
+static uint32_t capture_kind(const char *name, uint32_t len) {
+    if (len > 11 && strncmp(name, "definition.", 11) == 0) {
+        name += 11;
+        len -= 11;
+        if (len == 8 && strncmp(name, "function", 8) == 0)
+            return SYM_FUNCTION;
+        if (len == 5 && strncmp(name, "macro", 5) == 0)
+            return SYM_MACRO;
+        return SYM_TYPE;
+    }
+
+    return 0;
+}
+
+static void extract_symbols(struct indexEntry *entry, TSParser *parser,
+                            TSQueryCursor *cursor, const char *text,
+                            uint32_t len) {
+    TSQuery *query = language_tags_query(entry->lang);
+    TSTree *tree = ts_parser_parse_string(parser, NULL, text, len);
+    if (!tree)
+        return;
+
+    ts_query_cursor_exec(cursor, query, ts_tree_root_node(tree));
+
+    TSQueryMatch match;
+    while (ts_query_cursor_next_match(cursor, &match)) {
+        TSNode name_node;
+        int has_name = 0;
+        uint32_t kind = 0;
+
+        for (uint16_t i = 0; i < match.capture_count; i++) {
+            uint32_t capture_len;
+            const char *capture = ts_query_capture_name_for_id(
+                    query, match.captures[i].index, &capture_len);
+            if (capture_len == 4 && strncmp(capture, "name", 4) == 0) {
+                name_node = match.captures[i].node;
+                has_name = 1;
+            } else if (!kind) {
+                kind = capture_kind(capture, capture_len);
+            }
+        }
+
+        if (!has_name || !kind)
+            continue;
+
+        uint32_t start = ts_node_start_byte(name_node);
+        uint32_t end = ts_node_end_byte(name_node);
+        if (add_symbol(entry, &text[start], end - start,
+                       ts_node_start_point(name_node), kind) == -1)
+            break;
+    }
+
+    ts_tree_delete(tree);
+}
+
+static char *read_file(const char *root, const char *rel, size_t *len) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size > UINT32_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    char *text = mem_malloc(MEM_INDEX, st.st_size + 1);
+    size_t done = 0;
+    while (text && done < (size_t) st.st_size) {
+        ssize_t n = read(fd, text + done, st.st_size - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+
+    *len = done;
+    return text;
+}
+
+// every worker owns its parser and query cursor and takes files off the
+// shared list until it is empty
+static void *index_worker(void *arg) {
+    struct indexWork *work = arg;
+    TSParser *parser = ts_parser_new();
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    struct Language *parser_lang = NULL;
+
+    while (1) {
+        size_t i = atomic_fetch_add(&work->next, 1);
+        if (i >= work->pending_count)
+            break;
+
+        struct indexEntry *entry = work->pending[i];
+        size_t len;
+        char *text = read_file(work->root, entry->path, &len);
+        if (!text) {
+            // indexed with no symbols, and read again on the next update
+            entry->old = NULL;
+            entry->size = -1;
+            continue;
+        }
+
+        entry->hash = util_hash(UTIL_HASH_SEED, text, len);
+        // touched but not changed
+        if (entry->old && entry->old->hash == entry->hash) {
+            mem_free(text);
+            continue;
+        }
+        entry->old = NULL;
+
+        if (parser_lang != entry->lang) {
+            parser_lang = ts_parser_set_language(parser,
+                                                 language_grammar(entry->lang))
+                                  ? entry->lang
+                                  : NULL;
+        }
+        if (parser_lang)
+            extract_symbols(entry, parser, cursor, text, len);
+
+        mem_free(text);
+    }
+
+    ts_query_cursor_delete(cursor);
+    ts_parser_delete(parser);
+
+    return NULL;
+}
+
+static int parse_changed(const char *root, struct entryList *list) {
+    struct indexWork work = {.root = root};
+    atomic_init(&work.next, 0);
+
+    work.pending =
+            mem_malloc(MEM_INDEX, list->count * sizeof(*work.pending) + 1);
+    if (!work.pending)
+        return -1;
+
+    for (size_t i = 0; i < list->count; i++) {
+        struct indexEntry *entry = &list->entries[i];
+        if (entry->old && entry->old->mtime == entry->mtime &&
+            entry->old->size == entry->size) {
+            entry->hash = entry->old->hash;
+            continue;
+        }
+        work.pending[work.pending_count++] = entry;
+    }
+
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (workers > MAX_WORKERS)
+        workers = MAX_WORKERS;
+    if ((size_t) workers > work.pending_count)
+        workers = work.pending_count;
+
+    pthread_t threads[MAX_WORKERS];
+    long started = 0;
+    while (started < workers &&
+           pthread_create(&threads[started], NULL, index_worker, &work) == 0)
+        started++;
+
+    // no threads available, do it on this one
+    if (started == 0 && work.pending_count > 0)
+        index_worker(&work);
+
+    for (long i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    mem_free(work.pending);
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct indexEntry *) a)->path,
+                  ((const struct indexEntry *) b)->path);
+}
+
+struct nameRef {
+    const char *name;
+    uint32_t id;
+};
+
+static int compare_names(const void *a, const void *b) {
+    const struct nameRef *x = a;
+    const struct nameRef *y = b;
+    int cmp = strcmp(x->name, y->name);
+    if (cmp != 0)
+        return cmp;
+
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int write_index(const struct SymbolIndex *old, struct entryList *list,
+                       const char *path) {
+    struct SymbolIndexHeader header = {
+            .magic = SYMBOL_INDEX_MAGIC,
+            .version = SYMBOL_INDEX_VERSION,
+            .file_count = list->count,
+    };
+
+    size_t strings_cap = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        struct indexEntry *entry = &list->entries[i];
+        strings_cap += strlen(entry->path) + 1;
+        if (entry->old) {
+            header.symbol_count += entry->old->symbol_count;
+            for (uint32_t s = 0; s < entry->old->symbol_count; s++) {
+                const struct Symbol *symbol =
+                        &old->symbols[entry->old->first_symbol + s];
+                strings_cap += strlen(symbol_index_string(old, symbol->name)) +
+                               1;
+            }
+        } else {
+            header.symbol_count += entry->symbol_count;
+            strings_cap += entry->names_len;
+        }
+    }
+
+    size_t slots = header.symbol_count + 1;
+    struct SymbolFile *files =
+            mem_calloc(MEM_INDEX, list->count + 1, sizeof(*files));
+    struct Symbol *symbols = mem_malloc(MEM_INDEX, slots * sizeof(*symbols));
+    struct nameRef *names = mem_malloc(MEM_INDEX, slots * sizeof(*names));
+    uint32_t *by_name = mem_malloc(MEM_INDEX, slots * sizeof(*by_name));
+    char *strings = mem_malloc(MEM_INDEX, strings_cap + 1);
+    int result = -1;
+
+    if (!files || !symbols || !names || !by_name || !strings)
+        goto out;
+
+    uint32_t symbol_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        struct indexEntry *entry = &list->entries[i];
+        size_t len = strlen(entry->path) + 1;
+
+        files[i] = (struct SymbolFile){
+                .path = header.strings_size,
+                .first_symbol = symbol_count,
+                .mtime = entry->mtime,
+                .size = entry->size,
+                .hash = entry->hash,
+        };
+        memcpy(&strings[header.strings_size], entry->path, len);
+        header.strings_size += len;
+
+        uint32_t count = entry->old ? entry->old->symbol_count
+                                    : entry->symbol_count;
+        for (uint32_t s = 0; s < count; s++) {
+            struct Symbol symbol;
+            const char *name;
+            if (entry->old) {
+                symbol = old->symbols[entry->old->first_symbol + s];
+                name = symbol_index_string(old, symbol.name);
+            } else {
+                symbol = entry->symbols[s];
+                name = &entry->names[symbol.name];
+            }
+
+            len = strlen(name) + 1;
+            symbol.name = header.strings_size;
+            symbol.file = i;
+            memcpy(&strings[header.strings_size], name, len);
+            header.strings_size += len;
+
+            names[symbol_count] = (struct nameRef){
+                    .name = &strings[symbol.name],
+                    .id = symbol_count,
+            };
+            symbols[symbol_count++] = symbol;
+        }
+        files[i].symbol_count = count;
+    }
+
+    qsort(names, symbol_count, sizeof(*names), compare_names);
+    for (uint32_t s = 0; s < symbol_count; s++)
+        by_name[s] = names[s].id;
+
+    // written next to the old index and renamed over it, so readers that
+    // still map the old one are not affected
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        goto out;
+
+    if (util_write_all(fd, &header, sizeof(header)) == -1 ||
+        util_write_all(fd, files, list->count * sizeof(*files)) == -1 ||
+        util_write_all(fd, symbols, symbol_count * sizeof(*symbols)) == -1 ||
+        util_write_all(fd, by_name, symbol_count * sizeof(*by_name)) == -1 ||
+        util_write_all(fd, strings, header.strings_size) == -1 ||
+        close(fd) == -1 || rename(tmp_path, path) == -1) {
+        unlink(tmp_path);
+        goto out;
+    }
+    result = 0;
+
+out:
+    mem_free(files);
+    mem_free(symbols);
+    mem_free(names);
+    mem_free(by_name);
+    mem_free(strings);
+    return result;
+}
+
+// indexes every supported file below root into a new index file at path.
+// files whose mtime, size or content hash match old are not parsed again
+int symbol_index_update(const struct SymbolIndex *old, const char *root,
+                        const char *path) {
+    struct entryList list = {0};
+    int result = -1;
+
+    if (collect_files(root, &list) == -1)
+        goto out;
+
+    if (list.count > 0)
+        qsort(list.entries, list.count, sizeof(*list.entries),
+              compare_entries);
+    for (size_t i = 0; i < list.count; i++)
+        list.entries[i].old = find_file(old, list.entries[i].path);
+
+    if (parse_changed(root, &list) == -1)
+        goto out;
+
+    result = write_index(old, &list, path);
+
+out:
+    for (size_t i = 0; i < list.count; i++) {
+        mem_free(list.entries[i].path);
+        mem_free(list.entries[i].symbols);
+        mem_free(list.entries[i].names);
+    }
+    mem_free(list.entries);
+    return result;
+}
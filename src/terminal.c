@@ -1,14 +1,172 @@
 #include "terminal.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include "mem.h"
+
+// how long to wait for the rest of an escape sequence
+#define ESC_TIMEOUT_MS 100
+// how often to check whether a slow terminal caught up with a skipped frame
+#define PACE_INTERVAL_MS 10
+// how long to wait for the terminal to answer the startup queries
+#define PROBE_TIMEOUT_MS 200
 
 struct Global G;
 
+static int out_reserve(size_t len) {
+    if (G.out_len + len <= G.out_cap)
+        return 0;
+
+    size_t cap = G.out_cap ? G.out_cap : 4096;
+    while (cap < G.out_len + len)
+        cap *= 2;
+
+    char *out = mem_realloc(MEM_CELLS, G.out, cap);
+    if (!out) {
+        errno = ENOMEM;
+        return -1;
+    }
+    G.out = out;
+    G.out_cap = cap;
+
+    return 0;
+}
+
+// write as much as the terminal accepts without blocking and queue the rest
+static int terminal_write(const char *buf, size_t len) {
+    size_t written = 0;
+
+    if (G.out_len == 0) {
+        while (written < len) {
+            ssize_t n = write(STDOUT_FILENO, buf + written, len - written);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                errno = EIO;
+                return -1;
+            }
+            written += n;
+        }
+    }
+
+    if (written == len)
+        return 0;
+
+    if (out_reserve(len - written) == -1)
+        return -1;
+    memcpy(&G.out[G.out_len], buf + written, len - written);
+    G.out_len += len - written;
+
+    return 0;
+}
+
+int terminal_flush() {
+    size_t written = 0;
+
+    while (written < G.out_len) {
+        ssize_t n = write(STDOUT_FILENO, G.out + written, G.out_len - written);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            errno = EIO;
+            return -1;
+        }
+        written += n;
+    }
+
+    if (written > 0)
+        memmove(G.out, G.out + written, G.out_len - written);
+    G.out_len -= written;
+
+    return 0;
+}
+
+// bytes still queued by us plus bytes the tty has not handed to its reader
+size_t terminal_pending_bytes() {
+    int queued = 0;
+    if (ioctl(STDOUT_FILENO, TIOCOUTQ, &queued) == -1 || queued < 0)
+        queued = 0;
+
+    return G.out_len + queued;
+}
+
+// stdin may share its file description with the non-blocking stdout, so
+// every read waits in poll first. returns 1 on a byte, 0 on timeout
+static int read_byte(char *c, int timeout_ms) {
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    int n;
+
+    while ((n = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR)
+        ;
+    if (n == -1) {
+        errno = EIO;
+        return -1;
+    }
+    if (n == 0)
+        return 0;
+
+    ssize_t nread = read(STDIN_FILENO, c, 1);
+    if (nread == 1)
+        return 1;
+    if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+// ask for DEC mode 2026 (synchronized output). the DA1 query behind it is
+// answered by every terminal, so a missing DECRQM reply never stalls startup
+static int terminal_probe_sync() {
+    char buf[64];
+    size_t len = 0;
+    int supported = 0;
+
+    if (write(STDOUT_FILENO, "\e[?2026$p\e[c", 12) != 12) {
+        errno = EIO;
+        return -1;
+    }
+
+    while (len < sizeof(buf) - 1) {
+        if (read_byte(&buf[len], PROBE_TIMEOUT_MS) != 1)
+            break;
+        buf[++len] = '\0';
+
+        if (buf[len - 1] == 'y') {
+            // DECRPM: \e[?2026;<value>$y, 1 = set, 2 = reset, 3 and 4 =
+            // permanently set or reset. 0 is an unknown mode
+            int value;
+            char *reply = strstr(buf, "\e[?2026;");
+            if (reply && sscanf(reply + 8, "%d", &value) == 1)
+                supported = value >= 1 && value <= 4;
+            len = 0;
+        } else if (buf[len - 1] == 'c') {
+            break; // DA1 reply, nothing else is coming
+        }
+    }
+
+    return supported;
+}
+
 int terminal_end() {
+    // go back to blocking writes so the remaining output is drained
+    if (fcntl(STDOUT_FILENO, F_SETFL, G.orig_flags) == -1) {
+        errno = EIO;
+        return -1;
+    }
+    if (terminal_flush() == -1)
+        return -1;
+
     // leave alternate screen
     if (write(STDOUT_FILENO, "\e[?1049l", 8) != 8) {
         errno = EIO;
@@ -20,6 +178,54 @@ int terminal_end() {
     }
     cell_buffer_free(&G.front);
 
+    signal(SIGWINCH, SIG_DFL);
+    close(G.wake_pipe[0]);
+    close(G.wake_pipe[1]);
+
+    mem_free(G.frame);
+    mem_free(G.out);
+    G.frame = NULL;
+    G.out = NULL;
+    G.frame_cap = G.frame_len = 0;
+    G.out_cap = G.out_len = 0;
+
+    return 0;
+}
+
+static void terminal_on_resize(int sig) {
+    (void) sig;
+    int saved_errno = errno;
+
+    G.resized = 1;
+    terminal_wake();
+    errno = saved_errno;
+}
+
+// picks up the new window size. the cell buffer comes back blank
+static int terminal_resize() {
+    int width, height;
+    if (terminal_get_size(&width, &height) == -1)
+        return -1;
+
+    struct Cell *cells =
+            mem_calloc(MEM_CELLS, width * height, sizeof(struct Cell));
+    size_t frame_cap = 100 * width * height + 64;
+    char *frame = mem_malloc(MEM_CELLS, frame_cap);
+    if (!cells || !frame) {
+        mem_free(cells);
+        mem_free(frame);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mem_free(G.front.cells);
+    mem_free(G.frame);
+    G.front.cells = cells;
+    G.front.width = width;
+    G.front.height = height;
+    G.frame = frame;
+    G.frame_cap = frame_cap;
+
     return 0;
 }
 
@@ -53,12 +259,49 @@ int terminal_init() {
         return -1;
     }
 
-    G.front.cells = calloc(G.front.width * G.front.height, sizeof(struct Cell));
+    G.front.cells = mem_calloc(MEM_CELLS, G.front.width * G.front.height,
+                               sizeof(struct Cell));
     if (!G.front.cells) {
         perror("Failed to allocate cell buffer");
         return -1;
     }
 
+    G.frame_cap = 100 * G.front.width * G.front.height + 64;
+    G.frame = mem_malloc(MEM_CELLS, G.frame_cap);
+    if (!G.frame) {
+        perror("Failed to allocate frame buffer");
+        return -1;
+    }
+
+    // lets background work interrupt terminal_read_input()
+    if (pipe(G.wake_pipe) == -1 ||
+        fcntl(G.wake_pipe[0], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(G.wake_pipe[1], F_SETFL, O_NONBLOCK) == -1) {
+        perror("Failed to create wake pipe");
+        return -1;
+    }
+
+    struct sigaction sa = {.sa_handler = terminal_on_resize,
+                           .sa_flags = SA_RESTART};
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) {
+        perror("Failed to install the SIGWINCH handler");
+        return -1;
+    }
+
+    G.sync_output = terminal_probe_sync() == 1;
+    G.cursor_x = 1;
+    G.cursor_y = 1;
+    G.cursor_visible = 1;
+
+    // a slow pty must never stall the input loop behind a frame
+    G.orig_flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (G.orig_flags == -1 ||
+        fcntl(STDOUT_FILENO, F_SETFL, G.orig_flags | O_NONBLOCK) == -1) {
+        perror("Failed to make stdout non-blocking");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -72,7 +315,7 @@ int terminal_get_cursor_pos(int *x, int *y) {
     }
 
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) {
+        if (read_byte(&buf[i], ESC_TIMEOUT_MS) != 1) {
             errno = EIO;
             return -1;
         }
@@ -94,18 +337,18 @@ int terminal_get_cursor_pos(int *x, int *y) {
     return 0;
 }
 
+// the cursor is placed at the end of the next frame
 int terminal_move_cursor(int x, int y) {
-    char b[12];
-    int len_b = sprintf(b, "\e[%d;%dH", y, x);
-
-    if (write(STDOUT_FILENO, b, len_b) != len_b) {
-        errno = EIO;
-        return -1;
-    }
+    G.cursor_x = x;
+    G.cursor_y = y;
 
     return 0;
 }
 
+void terminal_show_cursor(int visible) {
+    G.cursor_visible = visible;
+}
+
 int terminal_get_size(int *cols, int *rows) {
     struct winsize ws;
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
@@ -123,7 +366,7 @@ int cell_buffer_init(struct CellBuffer *buffer, int width, int height) {
     buffer->width = width;
     buffer->height = height;
 
-    buffer->cells = malloc(width * height * sizeof(struct Cell));
+    buffer->cells = mem_malloc(MEM_CELLS, width * height * sizeof(struct Cell));
     if (!buffer->cells) {
         errno = ENOMEM;
         return -1;
@@ -141,7 +384,7 @@ int cell_buffer_init(struct CellBuffer *buffer, int width, int height) {
 
 void cell_buffer_free(struct CellBuffer *buffer) {
     if (buffer->cells) {
-        free(buffer->cells);
+        mem_free(buffer->cells);
         buffer->cells = NULL;
     }
 
@@ -149,8 +392,8 @@ void cell_buffer_free(struct CellBuffer *buffer) {
     buffer->height = 0;
 }
 
-int terminal_refresh() {
-    char buf[100 * G.front.width * G.front.height];
+static int terminal_render() {
+    char *buf = G.frame;
     int len_buf = 0;
 
 
@@ -158,13 +401,16 @@ int terminal_refresh() {
     uint32_t curr_bg = 0x000000;
     uint attr = 0;
 
-    strcpy(&buf[len_buf],
-           "\e[s\e[?25l\e[H"); // save current cursor position and hide the
-                               // cursor and move it to the top left
-    len_buf += 12;
+    if (G.sync_output) {
+        strcpy(&buf[len_buf], "\e[?2026h"); // begin synchronized update
+        len_buf += 8;
+    }
+
+    strcpy(&buf[len_buf], "\e[?25l"); // hide the cursor while drawing
+    len_buf += 6;
 
-    int curr_row = 0;
-    int curr_col = 0;
+    mbstate_t mb_state;
+    memset(&mb_state, 0, sizeof(mb_state));
 
     for (int index = 0; index < G.front.width * G.front.height; index++) {
         int row = index / G.front.width;
@@ -172,15 +418,10 @@ int terminal_refresh() {
 
         struct Cell cell = G.front.cells[index];
 
-        if (row != curr_row) {
-            curr_row = row;
-            curr_col = 0;
-            strcpy(&buf[len_buf], "\r\n");
-            len_buf += 2;
-        }
-
-        if (col != curr_col + 1) {
-            len_buf += sprintf(&buf[len_buf], "\e[%d;%dH", row, col);
+        // cells are written left to right, so only the start of a row needs
+        // an explicit cursor move
+        if (col == 0) {
+            len_buf += sprintf(&buf[len_buf], "\e[%d;1H", row + 1);
         }
 
         if (cell.s.fg != curr_fg && (cell.s.fg & ST_INHERIT) == 0) {
@@ -252,6 +493,7 @@ int terminal_refresh() {
                 strcpy(&buf[len_buf], "\e[5m"); // blink on
                 len_buf += 4;
             }
+            attr ^= BLINK;
         }
 
         int cell_inverse = (cell.s.attr & INVERSE) != 0;
@@ -283,26 +525,95 @@ int terminal_refresh() {
         }
 
 
-        char temp_buf[MB_CUR_MAX];
-        size_t len = wcstombs(temp_buf, &cell.ch, MB_CUR_MAX);
+        size_t len = wcrtomb(&buf[len_buf], cell.ch ? cell.ch : L' ',
+                             &mb_state);
         if (len == (size_t) -1) {
             errno = EILSEQ;
             return -1;
         }
-
-        strncpy(&buf[len_buf], temp_buf, len);
         len_buf += len;
     }
 
-    strcpy(&buf[len_buf],
-           "\e[u\e[?25h"); // restore cursor position and show the cursor
-    len_buf += 9;
+    len_buf += sprintf(&buf[len_buf], "\e[%d;%dH", G.cursor_y, G.cursor_x);
+    if (G.cursor_visible) {
+        strcpy(&buf[len_buf], "\e[?25h"); // show the cursor
+        len_buf += 6;
+    }
 
-    write(STDOUT_FILENO, buf, len_buf);
+    if (G.sync_output) {
+        strcpy(&buf[len_buf], "\e[?2026l"); // end synchronized update
+        len_buf += 8;
+    }
+
+    G.frame_len = len_buf;
 
     return 0;
 }
 
+int terminal_refresh() {
+    if (terminal_flush() == -1)
+        return -1;
+
+    // the terminal is more than a frame behind: the cell buffer already holds
+    // the newest state, so draw it once the output drains
+    if (G.out_len > 0 || terminal_pending_bytes() > G.frame_len) {
+        G.frame_pending = 1;
+        return 0;
+    }
+
+    G.frame_pending = 0;
+    if (terminal_render() == -1)
+        return -1;
+
+    return terminal_write(G.frame, G.frame_len);
+}
+
+// safe to call from any thread and from signal handlers
+void terminal_wake() {
+    char c = 0;
+    write(G.wake_pipe[1], &c, 1);
+}
+
+// block until input is available, pushing queued output and skipped frames
+// out whenever the terminal catches up. returns 1 if terminal_wake() was
+// called instead
+static int terminal_wait_input() {
+    while (1) {
+        struct pollfd fds[3] = {
+                {.fd = STDIN_FILENO, .events = POLLIN},
+                {.fd = STDOUT_FILENO, .events = G.out_len > 0 ? POLLOUT : 0},
+                {.fd = G.wake_pipe[0], .events = POLLIN},
+        };
+
+        int n = poll(fds, 3, G.frame_pending ? PACE_INTERVAL_MS : -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            errno = EIO;
+            return -1;
+        }
+
+        if ((fds[1].revents & POLLOUT) && terminal_flush() == -1)
+            return -1;
+        if (G.frame_pending && terminal_refresh() == -1)
+            return -1;
+
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            errno = EIO;
+            return -1;
+        }
+        if (fds[0].revents & POLLIN)
+            return 0;
+
+        if (fds[2].revents & POLLIN) {
+            char drain[64];
+            while (read(G.wake_pipe[0], drain, sizeof(drain)) > 0)
+                ;
+            return 1;
+        }
+    }
+}
+
 int terminal_cell_set(int x, int y, struct Cell cell) {
     if (x > G.front.width || x < 0) {
         errno = ERANGE;
@@ -322,21 +633,31 @@ int terminal_cell_set(int x, int y, struct Cell cell) {
 int terminal_read_input() {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            errno = EIO;
+    do {
+        int woken = terminal_wait_input();
+        if (woken == -1)
             return -1;
+        if (woken && G.resized) {
+            G.resized = 0;
+            if (terminal_resize() == -1)
+                return -1;
+            return KEY_RESIZE;
         }
-    }
+        if (woken)
+            return KEY_WAKE;
+        if ((nread = read_byte(&c, 0)) == -1)
+            return -1;
+    } while (nread != 1);
+
     if (c == '\x1b') {
         char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
+        if (read_byte(&seq[0], ESC_TIMEOUT_MS) != 1)
             return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
+        if (read_byte(&seq[1], ESC_TIMEOUT_MS) != 1)
             return '\x1b';
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
+                if (read_byte(&seq[2], ESC_TIMEOUT_MS) != 1)
                     return '\x1b';
                 if (seq[2] == '~') {
                     switch (seq[1]) {
@@ -0,0 +1,48 @@
+#include "util.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a, continues from hash so pieces can be hashed as one. start from
+// UTIL_HASH_SEED
+uint64_t util_hash(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// creates the directories leading up to the file at path
+int util_make_dirs(char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        int failed = mkdir(path, 0700) == -1 && errno != EEXIST;
+        *p = '/';
+        if (failed)
+            return -1;
+    }
+
+    return 0;
+}
+
+int util_write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
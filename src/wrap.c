@@ -0,0 +1,137 @@
+#include "wrap.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include "mem.h"
+
+static uint32_t line_count(uint32_t width, int cols) {
+    return width == 0 ? 1 : (width + cols - 1) / cols;
+}
+
+// every row starts out one line wide, set the widths and rebuild
+int wrap_layout_init(struct WrapLayout *layout, size_t count, int cols) {
+    layout->cols = cols > 0 ? cols : 1;
+    layout->count = count;
+    layout->widths = mem_calloc(MEM_INDEX, count + 1, sizeof(uint32_t));
+    layout->tree = mem_calloc(MEM_INDEX, count + 1, sizeof(uint32_t));
+    if (!layout->widths || !layout->tree) {
+        wrap_layout_free(layout);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    wrap_layout_rebuild(layout);
+
+    return 0;
+}
+
+void wrap_layout_free(struct WrapLayout *layout) {
+    mem_free(layout->widths);
+    mem_free(layout->tree);
+    layout->widths = NULL;
+    layout->tree = NULL;
+    layout->count = 0;
+}
+
+// O(n), after widths were written directly or cols changed
+void wrap_layout_rebuild(struct WrapLayout *layout) {
+    size_t n = layout->count;
+
+    for (size_t i = 1; i <= n; i++)
+        layout->tree[i] = line_count(layout->widths[i - 1], layout->cols);
+    for (size_t i = 1; i <= n; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= n)
+            layout->tree[parent] += layout->tree[i];
+    }
+
+    layout->top = 1;
+    while (layout->top * 2 <= n)
+        layout->top *= 2;
+}
+
+// takes over widths, which come from mem_malloc(), for when rows were
+// inserted or removed. the old widths are freed
+int wrap_layout_set_rows(struct WrapLayout *layout, uint32_t *widths,
+                         size_t count) {
+    uint32_t *tree = mem_realloc(MEM_INDEX, layout->tree,
+                                 sizeof(uint32_t) * (count + 1));
+    if (!tree) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mem_free(layout->widths);
+    layout->widths = widths;
+    layout->tree = tree;
+    layout->count = count;
+    wrap_layout_rebuild(layout);
+
+    return 0;
+}
+
+void wrap_layout_set_width(struct WrapLayout *layout, size_t row,
+                           uint32_t width) {
+    uint32_t before = line_count(layout->widths[row], layout->cols);
+    uint32_t after = line_count(width, layout->cols);
+    layout->widths[row] = width;
+    if (before == after)
+        return;
+
+    // unsigned wrap-around subtracts when the row got shorter
+    for (size_t i = row + 1; i <= layout->count; i += i & -i)
+        layout->tree[i] += after - before;
+}
+
+// the widths do not depend on cols, so no row has to be measured again
+void wrap_layout_set_cols(struct WrapLayout *layout, int cols) {
+    if (cols < 1)
+        cols = 1;
+    if (cols == layout->cols)
+        return;
+
+    layout->cols = cols;
+    wrap_layout_rebuild(layout);
+}
+
+size_t wrap_layout_lines(const struct WrapLayout *layout, size_t row) {
+    return line_count(layout->widths[row], layout->cols);
+}
+
+// the first display line of row
+size_t wrap_layout_line_of(const struct WrapLayout *layout, size_t row) {
+    size_t line = 0;
+    for (size_t i = row; i > 0; i -= i & -i)
+        line += layout->tree[i];
+
+    return line;
+}
+
+size_t wrap_layout_total(const struct WrapLayout *layout) {
+    return wrap_layout_line_of(layout, layout->count);
+}
+
+// the row display line falls in, *sub is set to the line within the row.
+// lines past the end map to the last line of the last row
+size_t wrap_layout_row_at(const struct WrapLayout *layout, size_t line,
+                          size_t *sub) {
+    if (layout->count == 0) {
+        *sub = 0;
+        return 0;
+    }
+
+    size_t total = wrap_layout_total(layout);
+    if (line >= total)
+        line = total - 1;
+
+    size_t pos = 0;
+    for (size_t step = layout->top; step > 0; step >>= 1) {
+        if (pos + step <= layout->count && layout->tree[pos + step] <= line) {
+            pos += step;
+            line -= layout->tree[pos];
+        }
+    }
+    *sub = line;
+
+    return pos;
+}
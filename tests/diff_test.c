@@ -0,0 +1,181 @@
+// checks that diff_lines() gives a minimal, well formed script on small
+// inputs and gives up on large ones past MAX_COST
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diff.h"
+
+// the cost diff.c stops searching at
+#define MAX_COST 4096
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// replays the hunks on old into out and returns how many lines they
+// delete and insert, checking that they are sorted and never adjacent
+static size_t apply(const struct Diff *diff, const uint64_t *old,
+                    size_t old_count, const uint64_t *new, uint64_t *out,
+                    size_t *out_count) {
+    size_t cost = 0;
+    size_t a = 0;
+    size_t o = 0;
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct DiffHunk *hunk = &diff->hunks[i];
+        CHECK(hunk->old_start >= a);
+        CHECK(hunk->old_start - a == hunk->new_start - o);
+        if (i > 0)
+            CHECK(hunk->old_start > a || hunk->new_start > o);
+        while (a < hunk->old_start)
+            out[o++] = old[a++];
+        for (size_t j = 0; j < hunk->new_count; j++)
+            out[o++] = new[hunk->new_start + j];
+        a += hunk->old_count;
+        cost += hunk->old_count + hunk->new_count;
+    }
+    while (a < old_count)
+        out[o++] = old[a++];
+
+    *out_count = o;
+    return cost;
+}
+
+// the length of the longest common subsequence, by dynamic programming
+static size_t lcs(const uint64_t *a, size_t n, const uint64_t *b, size_t m) {
+    size_t *table = calloc((n + 1) * (m + 1), sizeof(*table));
+    for (size_t i = n; i-- > 0;) {
+        for (size_t j = m; j-- > 0;) {
+            size_t *cell = &table[i * (m + 1) + j];
+            size_t down = table[(i + 1) * (m + 1) + j];
+            size_t right = table[i * (m + 1) + j + 1];
+            *cell = a[i] == b[j] ? table[(i + 1) * (m + 1) + j + 1] + 1
+                    : down > right ? down
+                                   : right;
+        }
+    }
+    size_t length = table[0];
+    free(table);
+
+    return length;
+}
+
+static void test_small(void) {
+    struct Diff diff = {0};
+    const char *old_text[] = {"a", "b", "c", "d", "e"};
+    const char *new_text[] = {"a", "x", "c", "e", "f"};
+    uint64_t old[5], new[5];
+    for (size_t i = 0; i < 5; i++) {
+        old[i] = diff_hash_line(old_text[i], 1);
+        new[i] = diff_hash_line(new_text[i], 1);
+    }
+
+    CHECK(diff_lines(&diff, old, 5, new, 5) == 0);
+    CHECK(diff.count == 3);
+    const struct DiffHunk expected[] = {
+            {1, 1, 1, 1}, // b became x
+            {3, 1, 3, 0}, // d was deleted
+            {5, 0, 4, 1}, // f was added
+    };
+    for (size_t i = 0; i < 3 && i < diff.count; i++)
+        CHECK(memcmp(&diff.hunks[i], &expected[i], sizeof(expected[i])) == 0);
+
+    CHECK(diff_find(&diff, 0) == NULL);
+    CHECK(diff_find(&diff, 1) == &diff.hunks[0]);
+    CHECK(diff_find(&diff, 2) == &diff.hunks[0]);
+    CHECK(diff_find(&diff, 3) == &diff.hunks[1]);
+    CHECK(diff_find(&diff, 9) == &diff.hunks[2]);
+
+    // equal versions have no hunks, an empty one is one hunk
+    CHECK(diff_lines(&diff, old, 5, old, 5) == 0 && diff.count == 0);
+    CHECK(diff_lines(&diff, old, 5, new, 0) == 0 && diff.count == 1);
+    CHECK(diff.hunks[0].old_count == 5 && diff.hunks[0].new_count == 0);
+
+    diff_free(&diff);
+}
+
+// few distinct values make for many equal lines to line up
+static void test_random(void) {
+    struct Diff diff = {0};
+    srand(3);
+    for (int iter = 0; iter < 5000; iter++) {
+        uint64_t old[40], new[40], out[80];
+        size_t n = rand() % 40;
+        size_t m = rand() % 40;
+        int values = 1 + rand() % 4;
+        for (size_t i = 0; i < n; i++)
+            old[i] = rand() % values;
+        for (size_t i = 0; i < m; i++)
+            new[i] = rand() % values;
+        if (rand() % 2) {
+            // a few changed lines
+            m = n;
+            memcpy(new, old, sizeof(old));
+            for (int i = rand() % 3; i > 0 && m > 0; i--)
+                new[rand() % m] = 9;
+        }
+
+        CHECK(diff_lines(&diff, old, n, new, m) == 0);
+        size_t out_count;
+        size_t cost = apply(&diff, old, n, new, out, &out_count);
+        CHECK(out_count == m && memcmp(out, new, m * sizeof(*new)) == 0);
+        CHECK(cost == n + m - 2 * lcs(old, n, new, m));
+    }
+    diff_free(&diff);
+}
+
+// every hundredth line is kept and the rest replaced. under MAX_COST each
+// gap is a hunk of its own, over it the search gives up and everything
+// after the first line is one replaced region
+static void test_max_cost(void) {
+    struct Diff diff = {0};
+    size_t sizes[] = {1000, 10000};
+    for (size_t s = 0; s < 2; s++) {
+        size_t count = sizes[s];
+        uint64_t *old = malloc(count * sizeof(*old));
+        uint64_t *new = malloc(count * sizeof(*new));
+        uint64_t *out = malloc(count * sizeof(*out));
+        for (size_t i = 0; i < count; i++) {
+            old[i] = i;
+            new[i] = i % 100 == 0 ? i : i + count;
+        }
+
+        CHECK(diff_lines(&diff, old, count, new, count) == 0);
+        size_t out_count;
+        size_t cost = apply(&diff, old, count, new, out, &out_count);
+        CHECK(out_count == count &&
+              memcmp(out, new, count * sizeof(*new)) == 0);
+
+        size_t optimal = 2 * (count - count / 100);
+        if (optimal <= 2 * MAX_COST) {
+            CHECK(diff.count == count / 100);
+            CHECK(cost == optimal);
+        } else {
+            CHECK(diff.count == 1);
+            CHECK(diff.hunks[0].old_start == 1 &&
+                  diff.hunks[0].old_count == count - 1);
+            CHECK(diff.hunks[0].new_start == 1 &&
+                  diff.hunks[0].new_count == count - 1);
+        }
+
+        free(old);
+        free(new);
+        free(out);
+    }
+    diff_free(&diff);
+}
+
+int main(void) {
+    test_small();
+    test_random();
+    test_max_cost();
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}
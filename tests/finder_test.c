@@ -0,0 +1,162 @@
+// walks a small tree and checks the picker's scoring, and that extending a
+// query gives the same matches as searching for it from scratch
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "finder.h"
+#include "util.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static const char *files[] = {
+        "src/main.c",     "src/finder.c",  "include/finder.h",
+        "docs/Format.md", "lib/mxaxixn.c", "tests/finder_test.c",
+};
+
+#define FILE_COUNT (sizeof(files) / sizeof(files[0]))
+
+static void write_file(const char *dir, const char *name, const char *text) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = NULL;
+    if (util_make_dirs(path) == 0)
+        file = fopen(path, "w");
+    if (!file || fputs(text, file) == EOF || fclose(file) == EOF) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static const char *top_path(const struct Finder *finder, size_t i) {
+    return file_list_path(finder->files, finder->top[i].file);
+}
+
+static int compare_files(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+// the matches are unsorted, so both sets are sorted before comparing
+static int same_matches(const struct Finder *a, const struct Finder *b) {
+    if (a->match_count != b->match_count || a->top_count != b->top_count)
+        return 0;
+    for (size_t i = 0; i < a->top_count; i++) {
+        if (a->top[i].file != b->top[i].file ||
+            a->top[i].score != b->top[i].score)
+            return 0;
+    }
+
+    qsort(a->matches, a->match_count, sizeof(*a->matches), compare_files);
+    qsort(b->matches, b->match_count, sizeof(*b->matches), compare_files);
+    return memcmp(a->matches, b->matches,
+                  a->match_count * sizeof(*a->matches)) == 0;
+}
+
+static void test_walk(const struct FileList *list) {
+    // build/ is ignored, .gitignore itself is listed
+    CHECK(list->count == FILE_COUNT + 1);
+    for (size_t i = 0; i < list->count; i++)
+        CHECK(strncmp(file_list_path(list, i), "build/", 6) != 0);
+}
+
+static void test_scoring(const struct FileList *list) {
+    struct Finder finder;
+    CHECK(finder_init(&finder, list, 8) == 0);
+    CHECK(finder.match_count == list->count);
+
+    // four letters in the basename, the first after a slash, no gaps
+    finder_set_query(&finder, "main", 4);
+    CHECK(finder.match_count == 2);
+    CHECK(strcmp(top_path(&finder, 0), "src/main.c") == 0);
+    CHECK(finder.top[0].score == 4 * (16 + 2) + 12 + 3 * 8);
+    CHECK(strcmp(top_path(&finder, 1), "lib/mxaxixn.c") == 0);
+    CHECK(finder.top[1].score < finder.top[0].score);
+
+    // equal scores go to the shorter path
+    finder_set_query(&finder, "finder", 6);
+    CHECK(finder.match_count == 3);
+    CHECK(finder.top[0].score == finder.top[1].score);
+    CHECK(strcmp(top_path(&finder, 0), "src/finder.c") == 0);
+    CHECK(strcmp(top_path(&finder, 1), "include/finder.h") == 0);
+
+    // an upper case letter makes the query case sensitive
+    finder_set_query(&finder, "F", 1);
+    CHECK(finder.match_count == 1);
+    CHECK(strcmp(top_path(&finder, 0), "docs/Format.md") == 0);
+    finder_set_query(&finder, "f", 1);
+    CHECK(finder.match_count == 4);
+
+    CHECK(finder_set_top(&finder, 1) == 0);
+    CHECK(finder.top_count == 1);
+    finder_set_query(&finder, "fi", 2);
+    CHECK(finder.top_count == 1 && finder.match_count == 3);
+
+    finder_free(&finder);
+}
+
+// every prefix only searches the previous matches, which has to give what a
+// fresh search gives. the last query does not extend and starts over
+static void test_extend(const struct FileList *list) {
+    static const char *queries[] = {"t", "te", "tes", "test", "tests/fi",
+                                    "tests/fix", "s"};
+    struct Finder finder;
+    CHECK(finder_init(&finder, list, 4) == 0);
+
+    size_t count = sizeof(queries) / sizeof(queries[0]);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(queries[i]);
+        size_t before = finder.match_count;
+        CHECK(finder_set_query(&finder, queries[i], len) == 0);
+        if (i + 1 < count)
+            CHECK(finder.match_count <= before);
+
+        struct Finder fresh;
+        CHECK(finder_init(&fresh, list, 4) == 0);
+        CHECK(finder_set_query(&fresh, queries[i], len) == 0);
+        CHECK(same_matches(&finder, &fresh));
+        finder_free(&fresh);
+    }
+    CHECK(finder.match_count == 4);
+
+    char query[300];
+    memset(query, 'a', sizeof(query));
+    CHECK(finder_set_query(&finder, query, sizeof(query)) == -1);
+
+    finder_free(&finder);
+}
+
+int main(void) {
+    char dir[] = "/tmp/liteedit-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for (size_t i = 0; i < FILE_COUNT; i++)
+        write_file(dir, files[i], "");
+    write_file(dir, "build/finder.o", "");
+    write_file(dir, ".gitignore", "build/\n");
+
+    struct FileList list;
+    if (file_list_walk(&list, dir) == -1) {
+        perror("file_list_walk");
+        return 1;
+    }
+    test_walk(&list);
+    test_scoring(&list);
+    test_extend(&list);
+    file_list_free(&list);
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}
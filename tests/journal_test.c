@@ -0,0 +1,215 @@
+// writes journals through the writer thread and checks that replay stops at
+// the first corrupt or truncated record
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "journal.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static const char *texts[] = {"one", "two!", "three", "four"};
+
+static struct JournalHeader test_header(int64_t base_size) {
+    struct timespec mtime = {.tv_sec = 1700000000, .tv_nsec = 5};
+    return journal_header(base_size, mtime);
+}
+
+// record i replaces byte 10 * i with texts[i]
+static void append(struct Journal *journal, size_t i) {
+    struct JournalEdit edit = {
+            .start = 10 * i,
+            .end = 10 * i + 1,
+            .len = strlen(texts[i]),
+    };
+    CHECK(journal_append(journal, JOURNAL_EDITS, &edit, 1, texts[i]) == 0);
+}
+
+static void write_journal(const char *path, size_t records) {
+    struct Journal journal;
+    struct JournalHeader header = test_header(100);
+    unlink(path);
+    CHECK(journal_start(&journal, path, &header, NULL) == 0);
+    for (size_t i = 0; i < records; i++)
+        append(&journal, i);
+    journal_close(&journal, false);
+}
+
+// opens the journal and checks it replays as records of append()
+static size_t replay(const char *path) {
+    struct JournalReader reader;
+    if (journal_read_open(&reader, path) == -1)
+        return (size_t) -1;
+
+    const struct JournalRecord *record;
+    const struct JournalEdit *edits;
+    const char *text;
+    size_t count = 0;
+    while (journal_read_next(&reader, &record, &edits, &text)) {
+        CHECK(record->type == JOURNAL_EDITS && record->count == 1);
+        CHECK(edits[0].start == 10 * count && edits[0].end == 10 * count + 1);
+        CHECK(edits[0].len == strlen(texts[count]) &&
+              memcmp(text + edits[0].text, texts[count], edits[0].len) == 0);
+        count++;
+    }
+    CHECK(count == reader.records);
+    journal_read_close(&reader);
+
+    return count;
+}
+
+// the offset of record index in the file
+static size_t record_offset(const char *path, size_t index) {
+    struct JournalReader reader;
+    CHECK(journal_read_open(&reader, path) == 0);
+    size_t offset = reader.offset;
+    const struct JournalRecord *record;
+    const struct JournalEdit *edits;
+    const char *text;
+    for (size_t i = 0; i <= index; i++) {
+        CHECK(journal_read_next(&reader, &record, &edits, &text));
+        offset = (const char *) record - (const char *) reader.map;
+    }
+    journal_read_close(&reader);
+
+    return offset;
+}
+
+static void poke(const char *path, size_t offset, char byte) {
+    int fd = open(path, O_WRONLY);
+    CHECK(fd != -1 && pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+static void test_replay(const char *path) {
+    write_journal(path, 3);
+    CHECK(replay(path) == 3);
+
+    // the intact part is continued, here all of it
+    struct JournalReader reader;
+    CHECK(journal_read_open(&reader, path) == 0);
+    struct JournalHeader header = test_header(100);
+    CHECK(journal_header_matches(reader.header, &header));
+    struct Journal journal;
+    CHECK(journal_start(&journal, path, reader.header, &reader) == 0);
+    journal_read_close(&reader);
+    append(&journal, 3);
+    journal_close(&journal, false);
+    CHECK(replay(path) == 4);
+}
+
+static void test_corrupt(const char *path) {
+    // a flipped byte in the text of the second record
+    write_journal(path, 3);
+    size_t second = record_offset(path, 1);
+    size_t text = second + sizeof(struct JournalRecord) +
+                  sizeof(struct JournalEdit);
+    poke(path, text, 'T');
+    CHECK(replay(path) == 1);
+
+    // a bad first record hides the intact ones after it
+    write_journal(path, 3);
+    poke(path, record_offset(path, 0), 9);
+    CHECK(replay(path) == 0);
+
+    // continuing a journal drops whatever followed its intact part
+    write_journal(path, 3);
+    poke(path, text, 'T');
+    struct JournalReader reader;
+    CHECK(journal_read_open(&reader, path) == 0);
+    struct Journal journal;
+    CHECK(journal_start(&journal, path, reader.header, &reader) == 0);
+    journal_read_close(&reader);
+    append(&journal, 1);
+    journal_close(&journal, false);
+    CHECK(replay(path) == 2);
+}
+
+static void test_truncated(const char *path) {
+    write_journal(path, 3);
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+
+    // the last record was cut off by a crash
+    CHECK(truncate(path, st.st_size - 1) == 0);
+    CHECK(replay(path) == 2);
+
+    // so was the header of the record before it
+    size_t second = record_offset(path, 1);
+    CHECK(truncate(path, second + 8) == 0);
+    CHECK(replay(path) == 1);
+
+    // a header alone has no records, less than one is not a journal
+    CHECK(truncate(path, sizeof(struct JournalHeader)) == 0);
+    CHECK(replay(path) == 0);
+    CHECK(truncate(path, sizeof(struct JournalHeader) - 1) == 0);
+    errno = 0;
+    CHECK(replay(path) == (size_t) -1 && errno == EINVAL);
+}
+
+static void test_bad_header(const char *path) {
+    write_journal(path, 1);
+    poke(path, 0, 'X');
+    errno = 0;
+    CHECK(replay(path) == (size_t) -1 && errno == EINVAL);
+
+    unlink(path);
+    errno = 0;
+    CHECK(replay(path) == (size_t) -1 && errno == ENOENT);
+}
+
+// compaction replaces the records and the header, later records follow it
+static void test_compact(const char *path) {
+    struct Journal journal;
+    struct JournalHeader header = test_header(100);
+    unlink(path);
+    CHECK(journal_start(&journal, path, &header, NULL) == 0);
+    append(&journal, 2);
+    append(&journal, 3);
+
+    struct JournalHeader saved = test_header(200);
+    struct JournalEdit edit = {.start = 0, .end = 1, .len = 3};
+    CHECK(journal_compact(&journal, &saved, JOURNAL_EDITS, &edit, 1,
+                          "one") == 0);
+    append(&journal, 1);
+    journal_close(&journal, false);
+
+    struct JournalReader reader;
+    CHECK(journal_read_open(&reader, path) == 0);
+    CHECK(journal_header_matches(reader.header, &saved));
+    journal_read_close(&reader);
+    CHECK(replay(path) == 2);
+}
+
+int main(void) {
+    char dir[] = "/tmp/liteedit-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/test.journal", dir);
+
+    test_replay(path);
+    test_corrupt(path);
+    test_truncated(path);
+    test_bad_header(path);
+    test_compact(path);
+    unlink(path);
+    rmdir(dir);
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}
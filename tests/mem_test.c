@@ -0,0 +1,122 @@
+// checks that every allocation is counted where it was made until it is
+// freed, and how the soft limits are read
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mem.h"
+#include "util.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void write_limits(const char *dir, const char *text) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/LiteEdit/memory", dir);
+    FILE *file = NULL;
+    if (util_make_dirs(path) == 0)
+        file = fopen(path, "w");
+    if (!file || fputs(text, file) == EOF || fclose(file) == EOF) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static void test_counts(void) {
+    char *rows = mem_malloc(MEM_ROWS, 100);
+    uint32_t *zeroed = mem_calloc(MEM_INDEX, 10, sizeof(*zeroed));
+    CHECK(rows && zeroed);
+    CHECK(mem_used(MEM_ROWS) == 100 && mem_used(MEM_INDEX) == 40);
+    for (size_t i = 0; i < 10; i++)
+        CHECK(zeroed[i] == 0);
+
+    // a block stays counted where it was first allocated, whatever
+    // subsystem grows it
+    memset(rows, 'x', 100);
+    rows = mem_realloc(MEM_TEXT, rows, 1000);
+    CHECK(rows && rows[99] == 'x');
+    CHECK(mem_used(MEM_ROWS) == 1000 && mem_used(MEM_TEXT) == 0);
+    rows = mem_realloc(MEM_TEXT, rows, 10);
+    CHECK(mem_used(MEM_ROWS) == 10);
+
+    // NULL is a fresh block
+    char *text = mem_realloc(MEM_TEXT, NULL, 7);
+    CHECK(text && mem_used(MEM_TEXT) == 7);
+    CHECK(mem_used(MEM_TOTAL) == 10 + 40 + 7);
+
+    // memory that is not allocated here, like a mapping
+    mem_account(MEM_JOURNAL, 4096);
+    CHECK(mem_used(MEM_JOURNAL) == 4096);
+    mem_account(MEM_JOURNAL, -4096);
+
+    mem_free(rows);
+    mem_free(zeroed);
+    mem_free(text);
+    mem_free(NULL);
+    CHECK(mem_used(MEM_TOTAL) == 0);
+
+    errno = 0;
+    CHECK(!mem_malloc(MEM_TEXT, SIZE_MAX) && errno == ENOMEM);
+    errno = 0;
+    CHECK(!mem_calloc(MEM_TEXT, SIZE_MAX / 2, 4) && errno == ENOMEM);
+    CHECK(mem_used(MEM_TOTAL) == 0);
+}
+
+static void test_limits(const char *dir) {
+    // no file is no limits
+    CHECK(mem_load_limits() == 0);
+    CHECK(mem_limit(MEM_TEXT) == 0 && !mem_over_limit(MEM_TEXT));
+
+    write_limits(dir, "# soft limits\n"
+                      "text 100\n"
+                      "\n"
+                      "  index 2K\n"
+                      "total 1g\n");
+    CHECK(mem_load_limits() == 0);
+    CHECK(mem_limit(MEM_TEXT) == 100);
+    CHECK(mem_limit(MEM_INDEX) == 2048);
+    CHECK(mem_limit(MEM_TOTAL) == 1ULL << 30);
+
+    // over only once past the limit
+    void *text = mem_malloc(MEM_TEXT, 100);
+    CHECK(!mem_over_limit(MEM_TEXT));
+    text = mem_realloc(MEM_TEXT, text, 101);
+    CHECK(mem_over_limit(MEM_TEXT) && !mem_over_limit(MEM_TOTAL));
+    mem_free(text);
+    CHECK(!mem_over_limit(MEM_TEXT));
+
+    // the valid lines still apply
+    write_limits(dir, "rows 5\nwidgets 10\ntext 3X\n");
+    errno = 0;
+    CHECK(mem_load_limits() == -1 && errno == EINVAL);
+    CHECK(mem_limit(MEM_ROWS) == 5 && mem_limit(MEM_TEXT) == 100);
+
+    char summary[256];
+    CHECK(mem_summary(summary, sizeof(summary)) == 0);
+    CHECK(strncmp(summary, "text 0 rows 0 ", 14) == 0);
+    CHECK(strstr(summary, " total 0") != NULL);
+}
+
+int main(void) {
+    char dir[] = "/tmp/liteedit-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("XDG_CONFIG_HOME", dir, 1);
+
+    test_counts();
+    test_limits(dir);
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+// writes a highlight snapshot and checks that it is only opened for the
+// file it was taken from
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mem.h"
+#include "snapshot.h"
+#include "util.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static const char text[] = "int main(void) {\n    return 0;\n}\n";
+static const struct timespec mtime = {.tv_sec = 1700000000, .tv_nsec = 42};
+
+// the spans cover the first line only
+static int write_snapshot(const char *path) {
+    static const struct SnapshotSpan spans[] = {{0, 3, 5}, {4, 8, 1}};
+    struct SnapshotHeader header = {
+            .span_count = 2,
+            .size = sizeof(text) - 1,
+            .mtime_sec = mtime.tv_sec,
+            .mtime_nsec = mtime.tv_nsec,
+            .covered = 17,
+            .hash = util_hash(UTIL_HASH_SEED, text, 17),
+    };
+
+    return snapshot_write(path, &header, spans);
+}
+
+// tries the snapshot against a file of size and mtime holding text
+static int open_as(const char *path, int64_t size, struct timespec when,
+                   const char *contents, size_t len) {
+    struct Snapshot snapshot;
+    errno = 0;
+    int result = snapshot_open(&snapshot, path, size, when, contents, len);
+    if (result == 0) {
+        CHECK(snapshot.header->span_count == 2);
+        CHECK(snapshot.spans[1].start == 4 && snapshot.spans[1].end == 8);
+        CHECK(mem_used(MEM_HIGHLIGHT) == snapshot.map_size);
+        snapshot_close(&snapshot);
+        CHECK(mem_used(MEM_HIGHLIGHT) == 0);
+    } else {
+        CHECK(!snapshot.map);
+    }
+
+    return result;
+}
+
+static void test_stale(const char *path) {
+    size_t len = sizeof(text) - 1;
+    CHECK(write_snapshot(path) == 0);
+    CHECK(open_as(path, len, mtime, text, len) == 0);
+
+    // the file was saved since
+    CHECK(open_as(path, len + 1, mtime, text, len) == -1 && errno == ESTALE);
+    struct timespec later = {mtime.tv_sec + 1, mtime.tv_nsec};
+    CHECK(open_as(path, len, later, text, len) == -1 && errno == ESTALE);
+    struct timespec nsec = {mtime.tv_sec, mtime.tv_nsec + 1};
+    CHECK(open_as(path, len, nsec, text, len) == -1 && errno == ESTALE);
+
+    // same size and mtime, but the covered bytes changed. a change past
+    // them does not matter
+    char edited[sizeof(text)];
+    memcpy(edited, text, sizeof(text));
+    edited[4] = 'M';
+    CHECK(open_as(path, len, mtime, edited, len) == -1 && errno == ESTALE);
+    edited[4] = 'm';
+    edited[len - 2] = ';';
+    CHECK(open_as(path, len, mtime, edited, len) == 0);
+
+    // less text than the snapshot covers
+    CHECK(open_as(path, len, mtime, text, 16) == -1 && errno == ESTALE);
+}
+
+static void test_malformed(const char *path) {
+    size_t len = sizeof(text) - 1;
+    CHECK(write_snapshot(path) == 0);
+
+    // a span too few
+    size_t header_size = sizeof(struct SnapshotHeader);
+    CHECK(truncate(path, header_size + sizeof(struct SnapshotSpan)) == 0);
+    CHECK(open_as(path, len, mtime, text, len) == -1 && errno == EINVAL);
+
+    CHECK(truncate(path, header_size - 1) == 0);
+    CHECK(open_as(path, len, mtime, text, len) == -1 && errno == EINVAL);
+
+    // long enough for a header, but not one
+    FILE *file = fopen(path, "w");
+    CHECK(file && fprintf(file, "%*s", (int) header_size, "") > 0);
+    if (file)
+        fclose(file);
+    CHECK(open_as(path, len, mtime, text, len) == -1 && errno == EINVAL);
+
+    unlink(path);
+    CHECK(open_as(path, len, mtime, text, len) == -1 && errno == ENOENT);
+}
+
+int main(void) {
+    char dir[] = "/tmp/liteedit-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/test.hl", dir);
+
+    test_stale(path);
+    test_malformed(path);
+    rmdir(dir);
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}
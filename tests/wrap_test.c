@@ -0,0 +1,117 @@
+// checks the Fenwick tree of a WrapLayout against line counts summed row by
+// row, through random width, column and row count changes
+#include <stdio.h>
+#include <stdlib.h>
+#include "mem.h"
+#include "wrap.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static size_t expected_lines(uint32_t width, int cols) {
+    return width == 0 ? 1 : (width + cols - 1) / cols;
+}
+
+// walks every row and every display line of it, the way a naive layout
+// would find them
+static void check_layout(const struct WrapLayout *layout) {
+    size_t line = 0;
+    for (size_t row = 0; row < layout->count; row++) {
+        size_t lines = expected_lines(layout->widths[row], layout->cols);
+        CHECK(wrap_layout_lines(layout, row) == lines);
+        CHECK(wrap_layout_line_of(layout, row) == line);
+        for (size_t i = 0; i < lines; i++) {
+            size_t sub;
+            CHECK(wrap_layout_row_at(layout, line + i, &sub) == row);
+            CHECK(sub == i);
+        }
+        line += lines;
+    }
+    CHECK(wrap_layout_total(layout) == line);
+}
+
+static void test_fixed(void) {
+    struct WrapLayout layout;
+    CHECK(wrap_layout_init(&layout, 4, 10) == 0);
+    CHECK(wrap_layout_total(&layout) == 4);
+
+    // 1, 3, 1 and 2 lines
+    uint32_t widths[] = {10, 25, 0, 11};
+    for (size_t i = 0; i < 4; i++)
+        wrap_layout_set_width(&layout, i, widths[i]);
+    CHECK(wrap_layout_total(&layout) == 7);
+    CHECK(wrap_layout_line_of(&layout, 3) == 5);
+
+    size_t sub;
+    CHECK(wrap_layout_row_at(&layout, 3, &sub) == 1 && sub == 2);
+    CHECK(wrap_layout_row_at(&layout, 4, &sub) == 2 && sub == 0);
+    // past the end is the last line of the last row
+    CHECK(wrap_layout_row_at(&layout, 100, &sub) == 3 && sub == 1);
+
+    // shrinking a row subtracts from the tree
+    wrap_layout_set_width(&layout, 1, 5);
+    CHECK(wrap_layout_total(&layout) == 5);
+    check_layout(&layout);
+
+    wrap_layout_set_cols(&layout, 0);
+    CHECK(layout.cols == 1);
+    CHECK(wrap_layout_total(&layout) == 10 + 5 + 1 + 11);
+    check_layout(&layout);
+
+    wrap_layout_free(&layout);
+
+    CHECK(wrap_layout_init(&layout, 0, 10) == 0);
+    CHECK(wrap_layout_total(&layout) == 0);
+    CHECK(wrap_layout_row_at(&layout, 0, &sub) == 0 && sub == 0);
+    wrap_layout_free(&layout);
+}
+
+static void test_random(void) {
+    srand(1);
+    for (int iter = 0; iter < 200; iter++) {
+        struct WrapLayout layout;
+        size_t count = rand() % 300;
+        CHECK(wrap_layout_init(&layout, count, 1 + rand() % 50) == 0);
+        for (size_t i = 0; i < count; i++)
+            layout.widths[i] = rand() % 200;
+        wrap_layout_rebuild(&layout);
+        check_layout(&layout);
+
+        for (int step = 0; step < 50; step++) {
+            int action = rand() % 10;
+            if (action == 0) {
+                wrap_layout_set_cols(&layout, 1 + rand() % 50);
+            } else if (action == 1) {
+                // rows were inserted or removed
+                count = rand() % 300;
+                uint32_t *widths =
+                        mem_malloc(MEM_INDEX, (count + 1) * sizeof(*widths));
+                CHECK(widths);
+                for (size_t i = 0; i < count; i++)
+                    widths[i] = rand() % 200;
+                CHECK(wrap_layout_set_rows(&layout, widths, count) == 0);
+            } else if (count > 0) {
+                wrap_layout_set_width(&layout, rand() % count, rand() % 300);
+            }
+            check_layout(&layout);
+        }
+        wrap_layout_free(&layout);
+    }
+}
+
+int main(void) {
+    test_fixed();
+    test_random();
+    CHECK(mem_used(MEM_INDEX) == 0);
+
+    if (failures == 0)
+        printf("ok\n");
+    return failures ? 1 : 0;
+}